@@ -8,17 +8,59 @@
     - Подсветка "дальних" точек (по разнице с текущей моделью регрессии).
     - Отображение координат (X,Y) в области данных около курсора.
     - Выбор между линейной регрессией и полиномиальной (2-й степени) нажатием клавиш 1 и 2.
+    - Автоматический выбор степени полинома (1..10) по AIC/BIC за один проход (клавиша A).
+    - Перекрёстная проверка (10-fold и leave-one-out) текущей модели (клавиша V).
+    - Робастная регрессия: Huber (H), Tukey (T), RANSAC (R) со степенью из последнего L/P.
+    - Ridge (G) и Lasso (O) для полинома 10-й степени; [ и ] двигают lambda по пути.
+    - Схлопывание повторяющихся точек во взвешенные (клавиша C или ключ --collapse).
+    - Точный режим для целочисленных данных (ключ --exact): разбор сразу в int64, суммы в int128.
+    - 95% доверительная полоса и полоса предсказания для МНК-моделей (клавиша B).
+    - Панель диагностики: R^2, RMSE, MAE, выбросы и влиятельные точки,
+      график остатков от x или их гистограмма справа от основного (клавиша D).
+    - Кусочно-линейная регрессия: границы динамическим программированием по префиксным
+      моментам, число сегментов по BIC (клавиша K).
+    - Кубический сглаживающий сплайн: пятидиагональная система за O(N),
+      lambda по GCV на том же разложении (клавиша M).
+    - Модели y = a*exp(b*x), y = a*x^b, y = a + b*ln(x) через преобразование к прямой
+      и уточнение Гаусса-Ньютоном в исходных координатах (клавиши E, Z, N; J - уточнение).
+    - LOESS: окна ближайших соседей двумя указателями по отсортированным x,
+      узлы сетки считаются параллельно (клавиша W, [ ] - доля соседей).
+    - Локальная подгонка на отрезке по x (Shift + перетаскивание, Esc - сброс)
+      по дереву моментов, которое обновляется за O(log N) при правках точек.
+    - Произвольная формула вроде a*sin(b*x)+c (клавиша F): компиляция в байткод,
+      якобиан прямым автодифференцированием по пачкам точек, Левенберг-Марквардт.
+    - Регрессия Деминга и ортогональная (полные МНК) для ошибок в обеих переменных
+      по моментам и центрированным ковариациям; для степени P - через собственный
+      вектор ковариации нормированных степеней (клавиша Q, [ ] - отношение дисперсий ошибок).
+    - Квантильная регрессия (клавиша U): медиана и полоса p90/p99, IRLS, где каждая
+      итерация - один проход взвешенных моментов сразу для всех квантилей.
+    - Оценка Тейла-Сена (клавиша X): медиана попарных наклонов за O(N log N)
+      через подсчёт инверсий сортировкой слиянием и случайное сужение интервала.
+    - Изотоническая регрессия (клавиша I): PAVA за O(N) по точкам, упорядоченным
+      деревом моментов (тот же отсортированный массив берут LOESS, сплайн и сегменты).
+    - Логистическая регрессия для целевых 0/1 (клавиша Y): Ньютон, градиент, гессиан
+      и правдоподобие - один слитный векторизуемый проход с быстрой сигмоидой.
+    - Мини-пакетный SGD/Adam без окна (--sgd) для потоков и огромных файлов:
+      потоковое чтение CSV, стандартизация, уточняемая по ходу потока, Hogwild, файл модели.
 
   Используется библиотека SFML для графики.
 
   Сборка (Ubuntu, например):
-      g++ main.cpp -o ImprovedLinRegGUI -lsfml-graphics -lsfml-window -lsfml-system
+      g++ -std=c++17 -O2 main.cpp -o ImprovedLinRegGUI -pthread -lsfml-graphics -lsfml-window -lsfml-system
 
   Запуск:
-      ./ImprovedLinRegGUI
+      ./ImprovedLinRegGUI [--collapse] [--exact]
+      ./ImprovedLinRegGUI --multi table.csv [target]   - множественная регрессия без окна
+                                                        (target - имя или номер столбца, по умолчанию последний)
+      ./ImprovedLinRegGUI --bench-theil-sen [N]        - Тейл-Сен: сверка с O(N^2) и время на N точках
+      ./ImprovedLinRegGUI --bench-logistic [N]         - логистическая регрессия на N синтетических строках
+      ./ImprovedLinRegGUI --sgd file.csv [degree] [--epochs N] [--batch N] [--lr X] [--plain]
+                          [--hogwild] [--checkpoint model.txt] [--every N]
+                                                        - SGD/Adam по потоку строк (file "-" - stdin),
+                                                          контрольные точки - каждые N мини-пакетов
 
   Требуется наличие файлов:
-      1) data.csv    - CSV-файл с начальными точками (X, Y).
+      1) data.csv    - CSV-файл с начальными точками (X, Y[, вес]).
       2) arial.ttf   - файл шрифта (для отрисовки текста).
 */
 
@@ -30,24 +72,88 @@
 #include <vector>
 #include <cmath>
 #include <limits>
+#include <algorithm>
 #include <cstring> // <-- Добавьте этот заголовок для memcpy
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <cctype>
+#include <cstdio>
 
 
-// Структура, чтобы хранить обучающие точки (X, Y)
+// Структура, чтобы хранить обучающие точки (X, Y) и вес точки
 struct Point
 {
     float x;
     float y;
+    float w = 1.f; // вес (например, число агрегированных наблюдений)
 };
 
-// Тип регрессии: линейная или полиномиальная (2-й степени)
+// Тип регрессии: линейная, полиномиальная (2-й степени), с автовыбором степени,
+// робастная или регуляризованная
 enum class RegressionType
 {
     LINEAR,
-    POLYNOMIAL2
+    POLYNOMIAL2,
+    AUTO_POLYNOMIAL, // степень выбирается автоматически по BIC
+    ROBUST_HUBER,    // IRLS с функцией Huber
+    ROBUST_TUKEY,    // IRLS с биквадратом Tukey
+    RANSAC,
+    RIDGE,           // полином степени kMaxAutoDegree со штрафом L2
+    LASSO,           // то же со штрафом L1 (координатный спуск)
+    SEGMENTED,       // кусочно-линейная, число сегментов по BIC
+    SMOOTHING_SPLINE,// кубический сглаживающий сплайн, lambda по GCV
+    LOESS,           // локальная линейная регрессия с весами tricube
+    EXPONENTIAL,     // y = a * exp(b * x)
+    POWER_LAW,       // y = a * x^b
+    LOGARITHMIC,     // y = a + b * ln(x)
+    CUSTOM,          // формула пользователя, Левенберг-Марквардт
+    THEIL_SEN,       // медиана попарных наклонов
+    DEMING,          // Деминг / полные МНК: ошибки и в x, и в y
+    QUANTILE,        // квантильная регрессия: медиана и полоса p90/p99
+    ISOTONIC,        // монотонная ступенчатая функция (PAVA)
+    LOGISTIC         // вероятность класса 1 для целевых 0/1 (Ньютон)
 };
 
-// Функция считывания CSV
+// Разбор одной строки CSV: X, Y и необязательный третий столбец - вес.
+// false для пустых и нечисловых строк и для строк с неположительным весом.
+bool parsePointLine(const std::string& line, Point& p)
+{
+    if (line.empty())
+        return false;
+
+    std::stringstream ss(line);
+    float xVal, yVal, wVal;
+    char delimiter;
+    // Попробуем считать x и y
+    if (!(ss >> xVal))
+        return false;
+    if (ss.peek() == ',' || ss.peek() == ';')
+        ss >> delimiter;
+    if (!(ss >> yVal))
+        return false;
+    p = {xVal, yVal};
+    // Вес, если есть; строки с неположительным весом пропускаем
+    if (ss.peek() == ',' || ss.peek() == ';')
+    {
+        ss >> delimiter;
+        if (ss >> wVal)
+        {
+            if (!(wVal > 0.f))
+                return false;
+            p.w = wVal;
+        }
+    }
+    return true;
+}
+
+// Функция считывания CSV целиком
 std::vector<Point> loadDataFromCSV(const std::string& filename)
 {
     std::vector<Point> data;
@@ -55,207 +161,5752 @@ std::vector<Point> loadDataFromCSV(const std::string& filename)
     if (!file.is_open())
     {
         std::cerr << "Error: Unable to open file " << filename << std::endl;
-        return data;
+        return data;
+    }
+
+    std::string line;
+    Point p;
+    while (std::getline(file, line))
+    {
+        if (parsePointLine(line, p))
+            data.push_back(p);
+    }
+    file.close();
+    return data;
+}
+
+// Потоковое чтение CSV пачками, без загрузки файла в память. Имя "-" -
+// стандартный ввод (поток, который может не кончаться).
+class CSVPointStream
+{
+public:
+    explicit CSVPointStream(const std::string& filename)
+    {
+        if (filename == "-")
+            in = &std::cin;
+        else
+        {
+            file.open(filename);
+            if (file.is_open())
+                in = &file;
+        }
+    }
+
+    bool isOpen() const { return in != nullptr; }
+    bool canRewind() const { return in == &file; }
+
+    // До maxCount следующих точек в batch (он очищается); false, если поток кончился
+    bool nextBatch(std::vector<Point>& batch, size_t maxCount)
+    {
+        batch.clear();
+        if (!in)
+            return false;
+        Point p;
+        while (batch.size() < maxCount && std::getline(*in, line))
+        {
+            if (parsePointLine(line, p))
+                batch.push_back(p);
+        }
+        return !batch.empty();
+    }
+
+    // К началу файла для следующей эпохи
+    bool rewind()
+    {
+        if (!canRewind())
+            return false;
+        file.clear();
+        file.seekg(0);
+        return static_cast<bool>(file);
+    }
+
+private:
+    std::ifstream file;
+    std::istream* in = nullptr;
+    std::string line;
+};
+
+// Функция сохранения данных в CSV
+void saveDataToCSV(const std::string& filename, const std::vector<Point>& dataPoints)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Unable to open save file " << filename << std::endl;
+        return;
+    }
+
+    // Столбец весов пишем, только если есть нетривиальные веса
+    bool weighted = std::any_of(dataPoints.begin(), dataPoints.end(),
+                                [](const Point& p) { return p.w != 1.f; });
+    for (auto& p : dataPoints)
+    {
+        file << p.x << "," << p.y;
+        if (weighted)
+            file << "," << p.w;
+        file << "\n";
+    }
+
+    file.close();
+    std::cout << "Data saved to " << filename << std::endl;
+}
+
+// ----------------------------------------
+// Пул потоков для параллельных проходов по данным
+// ----------------------------------------
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount)
+    {
+        // Вызывающий поток тоже выполняет задачи, поэтому рабочих на один меньше
+        for (unsigned i = 1; i < threadCount; ++i)
+            workers.emplace_back([this]{ workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (auto& w : workers)
+            w.join();
+    }
+
+    unsigned threadCount() const
+    {
+        return static_cast<unsigned>(workers.size()) + 1;
+    }
+
+    // Выполняет task(i) для i = 0..taskCount-1 и ждёт завершения всех задач.
+    // Вложенный вызов из задачи выполняется последовательно в текущем потоке.
+    void parallelFor(size_t taskCount, const std::function<void(size_t)>& task)
+    {
+        if (taskCount == 0)
+            return;
+        if (workers.empty() || taskCount == 1 || insideParallelRegion())
+        {
+            for (size_t i = 0; i < taskCount; ++i)
+                task(i);
+            return;
+        }
+
+        std::lock_guard<std::mutex> submitLock(submitMutex);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentTask = &task;
+            taskTotal = taskCount;
+            nextTask.store(0);
+            busyWorkers = workers.size();
+            ++generation;
+        }
+        wakeUp.notify_all();
+        runTasks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock, [this]{ return busyWorkers == 0; });
+        currentTask = nullptr;
+    }
+
+private:
+    static bool& insideParallelRegion()
+    {
+        thread_local bool inside = false;
+        return inside;
+    }
+
+    void runTasks()
+    {
+        bool& inside = insideParallelRegion();
+        bool previous = inside;
+        inside = true;
+        for (;;)
+        {
+            size_t i = nextTask.fetch_add(1);
+            if (i >= taskTotal)
+                break;
+            (*currentTask)(i);
+        }
+        inside = previous;
+    }
+
+    void workerLoop()
+    {
+        size_t seenGeneration = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [&]{ return stopping || generation != seenGeneration; });
+                if (stopping)
+                    return;
+                seenGeneration = generation;
+            }
+            runTasks();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busyWorkers == 0)
+                    allDone.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex submitMutex;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable allDone;
+    const std::function<void(size_t)>* currentTask = nullptr;
+    size_t taskTotal = 0;
+    std::atomic<size_t> nextTask{0};
+    size_t busyWorkers = 0;
+    size_t generation = 0;
+    bool stopping = false;
+};
+
+// Общий пул на всё приложение. Число потоков можно задать переменной
+// окружения LINREG_THREADS (например, для сверки результатов на 1 и N потоках).
+ThreadPool& globalThreadPool()
+{
+    static ThreadPool pool([]
+    {
+        const char* env = std::getenv("LINREG_THREADS");
+        int requested = env ? std::atoi(env) : 0;
+        if (requested > 0)
+            return static_cast<unsigned>(requested);
+        return std::max(1u, std::thread::hardware_concurrency());
+    }());
+    return pool;
+}
+
+// Делит [0, count) на куски по chunkSize и обрабатывает их в пуле: fn(chunk, lo, hi)
+void parallelForChunks(size_t count, size_t chunkSize,
+                       const std::function<void(size_t, size_t, size_t)>& fn)
+{
+    size_t chunks = (count + chunkSize - 1) / chunkSize;
+    globalThreadPool().parallelFor(chunks, [&](size_t c)
+    {
+        fn(c, c * chunkSize, std::min(count, (c + 1) * chunkSize));
+    });
+}
+
+// Размер блока детерминированной редукции (не зависит от числа потоков)
+const size_t kReductionBlock = 4096;
+
+// Детерминированная параллельная редукция по [0, count): блоки фиксированного
+// размера считаются в пуле (blockFn(lo, hi) -> T), а частичные результаты
+// складываются попарным деревом в фиксированном порядке (combine(acc, part)).
+// Разбиение и порядок сложения не зависят от потоков, поэтому результат
+// побитово одинаков на 1 и на 64 потоках; попарное дерево к тому же
+// накапливает ошибку округления как O(log N), а не O(N).
+template <class T, class BlockFn, class CombineFn>
+T deterministicReduce(size_t count, const T& identity, BlockFn blockFn, CombineFn combine)
+{
+    size_t blocks = (count + kReductionBlock - 1) / kReductionBlock;
+    if (blocks == 0)
+        return identity;
+
+    std::vector<T> partial(blocks, identity);
+    parallelForChunks(count, kReductionBlock, [&](size_t b, size_t lo, size_t hi)
+    {
+        partial[b] = blockFn(lo, hi);
+    });
+
+    for (size_t stride = 1; stride < blocks; stride *= 2)
+        for (size_t i = 0; i + stride < blocks; i += 2 * stride)
+            combine(partial[i], partial[i + stride]);
+    return partial[0];
+}
+
+// ----------------------------------------
+// Оценка Тейла-Сена: медиана попарных наклонов за O(N log N)
+// ----------------------------------------
+
+// Точки отсортированы по (x, y). Для пары i < j с x_i < x_j наклон s_ij < t
+// тогда и только тогда, когда y_j - t*x_j < y_i - t*x_i, т.е. число наклонов
+// меньше t - это число инверсий последовательности u(t) = y - t*x. Наклоны
+// между границами lo и hi - инверсии последовательности u(hi), переставленной
+// в порядке возрастания u(lo). Инверсии считаются сортировкой слиянием, а
+// медиана ищется сужением [lo, hi) по случайной выборке наклонов из интервала
+// (Dillencourt, Mount, Netanyahu): ожидаемо O(1) раундов по O(N log N).
+struct SlopeSelection
+{
+    std::vector<double> x, y, w;
+    std::vector<uint32_t> order; // порядок для нижней границы (см. inversionsAtBound)
+};
+
+// Элементов на задачу пула в проходе сортировки слиянием
+const size_t kInversionTask = 32768;
+// Длина начальных отрезков, сортируемых вставками
+const size_t kInversionRun = 16;
+
+// Элемент сортировки: ключ и вес лежат рядом с индексом, чтобы слияние шло
+// по непрерывной памяти, а не по keys[order[i]]
+struct InversionItem
+{
+    double key;
+    uint32_t index;
+    float weight;
+};
+
+// Сортирует order по keys (устойчиво, сравнение less) и сообщает о каждой инверсии:
+// onCross(state, task, left, iL, endL, r, leftWeight) - элемент r стоит в исходном
+// порядке после left[iL..endL) и меньше каждого из них; leftWeight - сумма весов
+// этих элементов (через суффиксные суммы, без обхода отрезка). Задачи на каждом
+// уровне обрабатываются в пуле; состояния возвращаются в фиксированном порядке
+// (уровень, задача), поэтому повторный проход видит инверсии в том же порядке.
+template <class State, class Less, class OnCross>
+std::vector<State> mergeSortInversions(std::vector<uint32_t>& order, const std::vector<double>& keys,
+                                       const std::vector<double>& weights, Less less, OnCross onCross)
+{
+    const size_t n = order.size();
+    std::vector<State> states;
+    std::vector<InversionItem> items(n), buffer(n);
+    for (size_t i = 0; i < n; ++i)
+        items[i] = {keys[order[i]], order[i], static_cast<float>(weights[order[i]])};
+
+    // Уровень 0: вставки внутри отрезков kInversionRun
+    states.resize((n + kInversionTask - 1) / kInversionTask);
+    parallelForChunks(n, kInversionTask, [&](size_t t, size_t lo, size_t hi)
+    {
+        for (size_t run = lo; run < hi; run += kInversionRun)
+        {
+            size_t end = std::min(hi, run + kInversionRun);
+            InversionItem* a = &items[run];
+            for (size_t i = 1; i < end - run; ++i)
+            {
+                InversionItem r = a[i];
+                size_t p = i;
+                double leftWeight = 0.0;
+                while (p > 0 && less(r, a[p - 1]))
+                {
+                    leftWeight += a[p - 1].weight;
+                    --p;
+                }
+                if (p < i)
+                {
+                    onCross(states[t], t, a, p, i, r.index, leftWeight);
+                    std::memmove(a + p + 1, a + p, (i - p) * sizeof(InversionItem));
+                    a[p] = r;
+                }
+            }
+        }
+    });
+
+    for (size_t width = kInversionRun; width < n; width *= 2)
+    {
+        size_t taskSize = std::max(2 * width, kInversionTask);
+        size_t base = states.size();
+        states.resize(base + (n + taskSize - 1) / taskSize);
+        parallelForChunks(n, taskSize, [&](size_t t, size_t lo, size_t hi)
+        {
+            State& st = states[base + t];
+            std::vector<double> suffix(width + 1);
+            for (size_t start = lo; start < hi; start += 2 * width)
+            {
+                size_t mid = std::min(hi, start + width);
+                size_t end = std::min(hi, start + 2 * width);
+                const InversionItem* left = &items[start];
+                size_t iL = 0, endL = mid - start, iR = mid, out = start;
+                suffix[endL] = 0.0;
+                for (size_t k = endL; k-- > 0;)
+                    suffix[k] = suffix[k + 1] + left[k].weight;
+                while (iL < endL && iR < end)
+                {
+                    if (less(items[iR], left[iL]))
+                    {
+                        onCross(st, base + t, left, iL, endL, items[iR].index, suffix[iL]);
+                        buffer[out++] = items[iR++];
+                    }
+                    else
+                        buffer[out++] = left[iL++];
+                }
+                while (iL < endL)
+                    buffer[out++] = left[iL++];
+                while (iR < end)
+                    buffer[out++] = items[iR++];
+            }
+        });
+        items.swap(buffer);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        order[i] = items[i].index;
+    return states;
+}
+
+// Ключи u(t) = y - t*x; на бесконечностях - порядок по x
+void slopeKeys(const SlopeSelection& s, double t, std::vector<double>& keys)
+{
+    keys.resize(s.x.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (t == -std::numeric_limits<double>::infinity())
+            keys[i] = s.x[i];
+        else if (t == std::numeric_limits<double>::infinity())
+            keys[i] = -s.x[i];
+        else
+            keys[i] = s.y[i] - t * s.x[i];
+    }
+}
+
+// Граница по наклону: "наклоны < t" или (inclusive) "наклоны <= t"
+struct SlopeBound
+{
+    double t;
+    bool inclusive = false;
+};
+
+// Инверсии последовательности u(bound.t) относительно s.order. Для
+// inclusive равные ключи пар с разными x тоже считаются инверсией:
+// порядок (u по возрастанию, x по убыванию) ставит правую точку пары
+// с наклоном ровно t раньше левой.
+template <class State, class OnCross>
+std::vector<State> inversionsAtBound(const SlopeSelection& s, SlopeBound bound, std::vector<uint32_t>& order,
+                                     OnCross onCross)
+{
+    std::vector<double> keys;
+    slopeKeys(s, bound.t, keys);
+    if (!bound.inclusive)
+        return mergeSortInversions<State>(order, keys, s.w,
+            [](const InversionItem& a, const InversionItem& b) { return a.key < b.key; }, onCross);
+    return mergeSortInversions<State>(order, keys, s.w, [&](const InversionItem& a, const InversionItem& b)
+    {
+        return a.key < b.key || (a.key == b.key && s.x[a.index] > s.x[b.index]);
+    }, onCross);
+}
+
+struct InversionCount
+{
+    uint64_t count = 0;
+    double weight = 0.0; // сумма w_i * w_j по инвертированным парам
+};
+
+// Число (и вес) наклонов ниже bound среди тех, что не ниже нижней границы
+// (s.order построен для неё). Устойчивая сортировка от s.order даёт порядок
+// для bound с теми же правилами равенства, поэтому при sortedOut != nullptr
+// он сохраняется: если bound станет нижней границей, сортировать заново не нужно.
+InversionCount countSlopesBelow(const SlopeSelection& s, SlopeBound bound, std::vector<uint32_t>* sortedOut = nullptr)
+{
+    std::vector<uint32_t> order = s.order;
+    std::vector<InversionCount> parts = inversionsAtBound<InversionCount>(s, bound, order,
+        [&](InversionCount& c, size_t, const InversionItem*, size_t iL, size_t endL, uint32_t r, double leftWeight)
+    {
+        c.count += endL - iL;
+        c.weight += s.w[r] * leftWeight;
+    });
+    if (sortedOut)
+        sortedOut->swap(order);
+
+    InversionCount total;
+    for (auto& p : parts)
+    {
+        total.count += p.count;
+        total.weight += p.weight;
+    }
+    return total;
+}
+
+// Наклоны между нижней границей и hi (пары (наклон, вес пары)): каждый берётся
+// с вероятностью probability, при probability >= 1 - все. Пропуски между
+// взятыми наклонами - геометрические, от генератора своей задачи, так что
+// выборка не зависит от числа потоков.
+std::vector<std::pair<double, double>> sampleSlopes(const SlopeSelection& s, SlopeBound hi, double probability,
+                                                    uint64_t seed)
+{
+    struct Found
+    {
+        bool started = false;
+        std::mt19937_64 rng;
+        uint64_t skip = 0; // сколько наклонов пропустить до следующего взятого
+        std::vector<std::pair<double, double>> slopes;
+    };
+    auto slopeOf = [&](uint32_t i, uint32_t j)
+    {
+        return std::make_pair((s.y[j] - s.y[i]) / (s.x[j] - s.x[i]), s.w[i] * s.w[j]);
+    };
+    const bool all = probability >= 1.0;
+    std::geometric_distribution<uint64_t> gap(all ? 0.5 : probability);
+
+    std::vector<uint32_t> order = s.order;
+    std::vector<Found> found = inversionsAtBound<Found>(s, hi, order,
+        [&](Found& f, size_t task, const InversionItem* left, size_t iL, size_t endL, uint32_t r, double)
+    {
+        if (all)
+        {
+            for (size_t k = iL; k < endL; ++k)
+                f.slopes.push_back(slopeOf(left[k].index, r));
+            return;
+        }
+        if (!f.started)
+        {
+            f.rng.seed(seed * 0x9E3779B97F4A7C15ull + task);
+            f.skip = gap(f.rng);
+            f.started = true;
+        }
+        uint64_t c = endL - iL;
+        while (f.skip < c)
+        {
+            f.slopes.push_back(slopeOf(left[iL + f.skip].index, r));
+            f.skip += 1 + gap(f.rng);
+        }
+        f.skip -= c;
+    });
+
+    std::vector<std::pair<double, double>> slopes;
+    for (auto& f : found)
+        slopes.insert(slopes.end(), f.slopes.begin(), f.slopes.end());
+    return slopes;
+}
+
+// Взвешенная медиана пар (значение, вес)
+double weightedMedian(std::vector<std::pair<double, double>>& values)
+{
+    if (values.empty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    double total = 0.0;
+    for (auto& v : values)
+        total += v.second;
+    double acc = 0.0;
+    for (auto& v : values)
+    {
+        acc += v.second;
+        if (acc >= 0.5 * total)
+            return v.first;
+    }
+    return values.back().first;
+}
+
+// Медиана наклонов по всем парам с разными x (вес пары w_i * w_j)
+double theilSenSlope(const std::vector<Point>& points)
+{
+    const size_t n = points.size();
+    std::vector<uint32_t> idx(n);
+    for (size_t i = 0; i < n; ++i)
+        idx[i] = static_cast<uint32_t>(i);
+    std::sort(idx.begin(), idx.end(), [&](uint32_t a, uint32_t b)
+    {
+        return points[a].x < points[b].x || (points[a].x == points[b].x && points[a].y < points[b].y);
+    });
+    SlopeSelection s;
+    s.x.resize(n);
+    s.y.resize(n);
+    s.w.resize(n);
+    s.order.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        s.x[i] = points[idx[i]].x;
+        s.y[i] = points[idx[i]].y;
+        s.w[i] = points[idx[i]].w;
+        s.order[i] = static_cast<uint32_t>(i); // порядок для нижней границы -inf: по x
+    }
+
+    // Все пары с разными x: (sum w)^2 - sum по группам равных x (sum w)^2, пополам
+    InversionCount inside;
+    double totalW = 0.0, sameW = 0.0, groupW = 0.0;
+    uint64_t sameCount = 0, groupCount = 0;
+    for (size_t i = 0; i <= n; ++i)
+    {
+        if (i == n || (i > 0 && s.x[i] != s.x[i - 1]))
+        {
+            sameW += groupW * groupW;
+            sameCount += groupCount * (groupCount - 1) / 2;
+            groupW = 0.0;
+            groupCount = 0;
+        }
+        if (i == n)
+            break;
+        groupW += s.w[i];
+        totalW += s.w[i];
+        ++groupCount;
+    }
+    inside.count = static_cast<uint64_t>(n) * (n - 1) / 2 - sameCount;
+    inside.weight = 0.5 * (totalW * totalW - sameW);
+    if (inside.count == 0 || !(inside.weight > 0.0))
+        return 0.0;
+
+    const double inf = std::numeric_limits<double>::infinity();
+    const double target = 0.5 * inside.weight;
+    const uint64_t enumerateBudget = std::max<uint64_t>(2 * n, 4096);
+    const double sampleSize = static_cast<double>(std::max<size_t>(n, 1024));
+
+    // Инвариант: вес наклонов ниже lo меньше target, ниже hi - не меньше;
+    // inside - наклоны между ними, s.order - порядок для lo
+    SlopeBound lo{-inf}, hi{inf};
+    double below = 0.0;
+    for (uint64_t round = 0; round < 64; ++round)
+    {
+        if (inside.count <= enumerateBudget)
+        {
+            std::vector<std::pair<double, double>> slopes = sampleSlopes(s, hi, 1.0, 0);
+            std::sort(slopes.begin(), slopes.end());
+            double acc = below;
+            for (auto& [slope, weight] : slopes)
+            {
+                acc += weight;
+                if (acc >= target)
+                    return slope;
+            }
+            return slopes.empty() ? lo.t : slopes.back().first;
+        }
+
+        // Случайная выборка наклонов интервала и новые границы [a, b] вокруг
+        // ожидаемой позиции медианы с запасом в 3 стандартных отклонения
+        std::vector<std::pair<double, double>> sample =
+            sampleSlopes(s, hi, sampleSize / static_cast<double>(inside.count), 12345 + round);
+        if (sample.empty())
+            continue;
+        std::sort(sample.begin(), sample.end());
+        double last = static_cast<double>(sample.size() - 1);
+        double center = (target - below) / inside.weight * static_cast<double>(sample.size());
+        double margin = 3.0 * std::sqrt(static_cast<double>(sample.size()));
+        SlopeBound newLo{sample[static_cast<size_t>(std::clamp(center - margin, 0.0, last))].first, false};
+        SlopeBound newHi{sample[static_cast<size_t>(std::clamp(center + margin, 0.0, last))].first, true};
+
+        std::vector<uint32_t> orderLo, orderHi;
+        InversionCount toLo = countSlopesBelow(s, newLo, &orderLo);
+        InversionCount toHi = countSlopesBelow(s, newHi, &orderHi);
+
+        if (target <= below + toLo.weight)
+        {
+            hi = newLo;
+            inside = toLo;
+        }
+        else if (target <= below + toHi.weight)
+        {
+            // Медиана - одно из наклонов, равных a = b
+            if (newLo.t == newHi.t)
+                return newLo.t;
+            s.order.swap(orderLo);
+            lo = newLo;
+            hi = newHi;
+            below += toLo.weight;
+            inside.count = toHi.count - toLo.count;
+            inside.weight = toHi.weight - toLo.weight;
+        }
+        else
+        {
+            s.order.swap(orderHi);
+            lo = newHi;
+            below += toHi.weight;
+            inside.count -= toHi.count;
+            inside.weight -= toHi.weight;
+        }
+    }
+    return lo.t;
+}
+
+// Прямая Тейла-Сена: наклон - медиана попарных наклонов,
+// свободный член - медиана y - slope*x
+std::pair<float, float> computeTheilSenRegression(const std::vector<Point>& points)
+{
+    if (points.empty())
+        return {0.f, 0.f};
+    double slope = theilSenSlope(points);
+    std::vector<std::pair<double, double>> offsets(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+        offsets[i] = {points[i].y - slope * points[i].x, points[i].w};
+    double intercept = weightedMedian(offsets);
+    return {static_cast<float>(slope), static_cast<float>(intercept)};
+}
+
+// Эталон за O(N^2): все наклоны и их медиана (для сверки и бенчмарка)
+double theilSenSlopeNaive(const std::vector<Point>& points)
+{
+    std::vector<std::pair<double, double>> slopes;
+    for (size_t i = 0; i < points.size(); ++i)
+        for (size_t j = i + 1; j < points.size(); ++j)
+            if (points[i].x != points[j].x)
+                slopes.push_back({(static_cast<double>(points[j].y) - points[i].y) /
+                                  (static_cast<double>(points[j].x) - points[i].x),
+                                  static_cast<double>(points[i].w) * points[j].w});
+    return weightedMedian(slopes);
+}
+
+// Консольный режим --bench-theil-sen [N]: сверка с эталоном на малых N
+// и время быстрого алгоритма на N точках
+int runTheilSenBenchmark(size_t bigCount)
+{
+    std::mt19937 rng(7);
+    std::normal_distribution<float> noise(0.f, 1.f);
+    std::uniform_real_distribution<float> uniform(0.f, 100.f);
+    auto makePoints = [&](size_t count)
+    {
+        std::vector<Point> pts(count);
+        for (auto& p : pts)
+        {
+            p.x = uniform(rng);
+            p.y = 2.5f * p.x - 7.f + noise(rng);
+            if (uniform(rng) < 10.f)
+                p.y += 50.f * noise(rng); // 10% грубых выбросов
+        }
+        return pts;
+    };
+    auto seconds = [](auto from) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - from).count();
+    };
+
+    std::cout << "N        naive, s    fast, s     slope (naive / fast)" << std::endl;
+    double naivePerPair = 0.0;
+    for (size_t count : {1000, 2000, 4000})
+    {
+        std::vector<Point> pts = makePoints(count);
+        auto t0 = std::chrono::steady_clock::now();
+        double naive = theilSenSlopeNaive(pts);
+        double naiveTime = seconds(t0);
+        naivePerPair = naiveTime / (0.5 * count * count);
+        t0 = std::chrono::steady_clock::now();
+        double fast = theilSenSlope(pts);
+        double fastTime = seconds(t0);
+        std::cout << count << "\t " << naiveTime << "\t    " << fastTime << "\t" << naive << " / " << fast
+                  << (naive == fast ? "" : "  MISMATCH") << std::endl;
+    }
+
+    std::vector<Point> pts = makePoints(bigCount);
+    auto t0 = std::chrono::steady_clock::now();
+    auto [slope, intercept] = computeTheilSenRegression(pts);
+    double fastTime = seconds(t0);
+    // Время эталона на bigCount точках - экстраполяция по числу пар с N = 4000
+    double naiveEstimate = naivePerPair * 0.5 * static_cast<double>(bigCount) * bigCount;
+    std::cout << bigCount << " points: fast " << fastTime << " s, naive ~" << naiveEstimate
+              << " s (estimated), speedup ~" << naiveEstimate / fastTime << "x" << std::endl;
+    std::cout << "slope=" << slope << ", intercept=" << intercept << std::endl;
+    return 0;
+}
+
+// ----------------------------------------
+// Полиномиальная регрессия 2-й степени: y = a*x^2 + b*x + c
+// ----------------------------------------
+struct Poly2Coeffs
+{
+    float a; // при x^2
+    float b; // при x
+    float c; // свободный член
+};
+
+// Вспомогательная функция для вычисления значения полинома 2-й степени
+float evaluatePoly2(const Poly2Coeffs& coeffs, float x)
+{
+    return coeffs.a*x*x + coeffs.b*x + coeffs.c;
+}
+
+// ----------------------------------------
+// Полиномиальная регрессия произвольной степени по общим степенным моментам
+// ----------------------------------------
+
+// Максимальная степень для автоматического выбора
+const int kMaxAutoDegree = 10;
+
+// Степенные моменты относительно t = (x - center) / scale.
+// Масштабирование в [-1, 1] обязательно: при x ~ 2e5 суммы x^20 (~1e106) делают
+// нормальную матрицу безнадёжно плохо обусловленной.
+struct PowerMoments
+{
+    int maxDegree = 0;
+    double center = 0.0;
+    double scale = 1.0;
+    std::vector<double> St;   // St[k]  = сумма t^k,   k = 0..2*maxDegree (St[0] = n)
+    std::vector<double> Sty;  // Sty[k] = сумма t^k*y, k = 0..maxDegree
+    double Syy = 0.0;         // сумма y^2
+};
+
+// Полином в масштабированной переменной: y = sum coeffs[k] * t^k, t = (x - center) / scale
+struct PolyModel
+{
+    int degree = 0;
+    double center = 0.0;
+    double scale = 1.0;
+    std::vector<double> coeffs;
+};
+
+// Итоги подгонки одной степени
+struct DegreeFitReport
+{
+    int degree = 0;
+    bool valid = false;
+    double rss = 0.0;
+    double r2 = 0.0;
+    double aic = 0.0;
+    double bic = 0.0;
+    PolyModel model;
+};
+
+// Критерий автоматического выбора степени
+enum class DegreeCriterion
+{
+    AIC,
+    BIC
+};
+
+// Центр и масштаб, переводящие диапазон X в [-1, 1]
+void choosePolynomialScaling(const std::vector<Point>& points, double& center, double& scale)
+{
+    center = 0.0;
+    scale = 1.0;
+    if (points.empty())
+        return;
+
+    float lo = points.front().x;
+    float hi = points.front().x;
+    for (auto& p : points)
+    {
+        if (p.x < lo) lo = p.x;
+        if (p.x > hi) hi = p.x;
+    }
+    center = 0.5 * (static_cast<double>(lo) + static_cast<double>(hi));
+    double half = 0.5 * (static_cast<double>(hi) - static_cast<double>(lo));
+    if (half > 0.0)
+        scale = half;
+}
+
+// Один проход по данным: все моменты до t^(2*maxDegree).
+// Точки обрабатываются блоками, чтобы внутренние циклы по точкам шли без зависимостей
+// (компилятор их векторизует), а степени t считались умножением, а не pow().
+// Суммы взвешены весами точек Point::w; weights (если заданы) - дополнительные
+// множители (например, веса IRLS).
+PowerMoments accumulatePowerMoments(const Point* points, size_t count, int maxDegree,
+                                    double center, double scale, const double* weights = nullptr)
+{
+    PowerMoments m;
+    m.maxDegree = maxDegree;
+    m.center = center;
+    m.scale = scale;
+    m.St.assign(2 * maxDegree + 1, 0.0);
+    m.Sty.assign(maxDegree + 1, 0.0);
+
+    const double invScale = 1.0 / scale;
+    const size_t kBlock = 256;
+    double t[kBlock], y[kBlock], pw[kBlock];
+
+    for (size_t start = 0; start < count; start += kBlock)
+    {
+        size_t len = std::min(kBlock, count - start);
+        double syy = 0.0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            t[i]  = (points[start + i].x - center) * invScale;
+            y[i]  = points[start + i].y;
+            pw[i] = points[start + i].w * (weights ? weights[start + i] : 1.0);
+            syy  += pw[i] * y[i] * y[i];
+        }
+        m.Syy += syy;
+
+        for (int k = 0; k <= 2 * maxDegree; ++k)
+        {
+            double s = 0.0;
+            for (size_t i = 0; i < len; ++i)
+                s += pw[i];
+            m.St[k] += s;
+
+            if (k <= maxDegree)
+            {
+                double sy = 0.0;
+                for (size_t i = 0; i < len; ++i)
+                    sy += pw[i] * y[i];
+                m.Sty[k] += sy;
+            }
+
+            for (size_t i = 0; i < len; ++i)
+                pw[i] *= t[i];
+        }
+    }
+    return m;
+}
+
+PowerMoments accumulatePowerMoments(const std::vector<Point>& points, int maxDegree,
+                                    double center, double scale)
+{
+    return accumulatePowerMoments(points.data(), points.size(), maxDegree, center, scale);
+}
+
+// acc += part (моменты с одинаковыми center/scale/maxDegree)
+void addMoments(PowerMoments& acc, const PowerMoments& part)
+{
+    for (size_t k = 0; k < acc.St.size(); ++k)
+        acc.St[k] += part.St[k];
+    for (size_t k = 0; k < acc.Sty.size(); ++k)
+        acc.Sty[k] += part.Sty[k];
+    acc.Syy += part.Syy;
+}
+
+// Взвешенные моменты детерминированной параллельной редукцией по блокам
+PowerMoments accumulatePowerMomentsParallel(const std::vector<Point>& points, const double* weights,
+                                            int maxDegree, double center, double scale)
+{
+    if (points.size() <= kReductionBlock)
+        return accumulatePowerMoments(points.data(), points.size(), maxDegree, center, scale, weights);
+
+    return deterministicReduce(points.size(), PowerMoments{}, [&](size_t lo, size_t hi)
+    {
+        return accumulatePowerMoments(points.data() + lo, hi - lo, maxDegree, center, scale,
+                                      weights ? weights + lo : nullptr);
+    }, addMoments);
+}
+
+// Решаем нормальные уравнения сразу для всех степеней 1..maxDegree.
+// Матрица G[i][j] = St[i+j] для степени d - ведущий блок матрицы для степени maxDegree,
+// поэтому множитель Холецкого G = L*L^T наращивается по одной строке на степень.
+// Вспомогательный вектор z = L^-1 * b тоже общий, а RSS(d) = Syy - (z0^2 + ... + zd^2).
+std::vector<DegreeFitReport> fitAllPolynomialDegrees(const PowerMoments& m, int maxDegree)
+{
+    std::vector<DegreeFitReport> reports;
+    int D = std::min(maxDegree, m.maxDegree);
+    if (D < 1 || m.St.empty() || m.St[0] <= 0.0)
+        return reports;
+
+    const int size = D + 1;
+    std::vector<double> L(size * size, 0.0);
+    std::vector<double> z(size, 0.0);
+
+    double n = m.St[0];
+    double meanY = m.Sty[0] / n;
+    double tss = m.Syy - n * meanY * meanY;
+    double explained = 0.0;
+
+    for (int d = 0; d <= D; ++d)
+    {
+        // Новая строка множителя Холецкого
+        bool degenerate = false;
+        for (int j = 0; j <= d; ++j)
+        {
+            double s = m.St[d + j];
+            for (int k = 0; k < j; ++k)
+                s -= L[d * size + k] * L[j * size + k];
+
+            if (j < d)
+            {
+                L[d * size + j] = s / L[j * size + j];
+            }
+            else
+            {
+                // Пивот почти ноль - различных X не хватает для этой степени
+                if (s <= 1e-13 * m.St[2 * d])
+                    degenerate = true;
+                else
+                    L[d * size + d] = std::sqrt(s);
+            }
+        }
+        if (degenerate)
+            break;
+
+        double s = m.Sty[d];
+        for (int k = 0; k < d; ++k)
+            s -= L[d * size + k] * z[k];
+        z[d] = s / L[d * size + d];
+        explained += z[d] * z[d];
+
+        if (d == 0)
+            continue;
+
+        DegreeFitReport r;
+        r.degree = d;
+        int params = d + 1;
+        if (n <= params)
+            break;
+
+        // Обратный ход: L_d^T * coeffs = z_d
+        r.model.degree = d;
+        r.model.center = m.center;
+        r.model.scale = m.scale;
+        r.model.coeffs.assign(params, 0.0);
+        for (int i = d; i >= 0; --i)
+        {
+            double v = z[i];
+            for (int k = i + 1; k <= d; ++k)
+                v -= L[k * size + i] * r.model.coeffs[k];
+            r.model.coeffs[i] = v / L[i * size + i];
+        }
+
+        r.rss = std::max(m.Syy - explained, 0.0);
+        r.r2 = (tss > 0.0) ? 1.0 - r.rss / tss : 1.0;
+        // Нулевой RSS (точная интерполяция) даёт log(0), ограничим снизу
+        double rssFloor = std::max(r.rss, 1e-12 * std::max(tss, 1e-300));
+        double logLik = n * std::log(rssFloor / n);
+        r.aic = logLik + 2.0 * params;
+        r.bic = logLik + params * std::log(n);
+        r.valid = true;
+        reports.push_back(r);
+    }
+    return reports;
+}
+
+// Индекс лучшей степени по выбранному критерию (-1, если подходящих нет)
+int selectBestDegree(const std::vector<DegreeFitReport>& reports, DegreeCriterion criterion)
+{
+    int best = -1;
+    double bestScore = std::numeric_limits<double>::max();
+    for (int i = 0; i < static_cast<int>(reports.size()); ++i)
+    {
+        if (!reports[i].valid)
+            continue;
+        double score = (criterion == DegreeCriterion::AIC) ? reports[i].aic : reports[i].bic;
+        if (score < bestScore)
+        {
+            bestScore = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+// Полная процедура: масштаб, один проход моментов, решение всех степеней.
+// moments (если задан) получает моменты прохода - из них же считаются интервалы.
+std::vector<DegreeFitReport> fitPolynomialDegrees(const std::vector<Point>& points, int maxDegree,
+                                                  PowerMoments* moments = nullptr)
+{
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    PowerMoments m = accumulatePowerMomentsParallel(points, nullptr, maxDegree, center, scale);
+    if (moments)
+        *moments = m;
+    return fitAllPolynomialDegrees(m, maxDegree);
+}
+
+// Значение полинома схемой Горнера
+float evaluatePolyModel(const PolyModel& model, float x)
+{
+    if (model.coeffs.empty())
+        return 0.f;
+    double t = (x - model.center) / model.scale;
+    double v = 0.0;
+    for (int k = static_cast<int>(model.coeffs.size()) - 1; k >= 0; --k)
+        v = v * t + model.coeffs[k];
+    return static_cast<float>(v);
+}
+
+// Коэффициенты q(s) = p(g*s + h) по коэффициентам p (схема Горнера над полиномами)
+std::vector<double> substituteAffine(const std::vector<double>& coeffs, double g, double h)
+{
+    std::vector<double> q;
+    for (auto it = coeffs.rbegin(); it != coeffs.rend(); ++it)
+    {
+        // q = q * (g*s + h) + c
+        std::vector<double> next(q.size() + 1, 0.0);
+        for (size_t j = 0; j < q.size(); ++j)
+        {
+            next[j + 1] += g * q[j];
+            next[j] += h * q[j];
+        }
+        next[0] += *it;
+        q.swap(next);
+    }
+    q.resize(coeffs.size());
+    return q;
+}
+
+// Полином с коэффициентами при x^k (как у прямой и Poly2Coeffs) в переменной
+// t = (x - center) / scale заданного базиса
+PolyModel polyModelFromX(const std::vector<double>& xCoeffs, double center, double scale)
+{
+    PolyModel model;
+    model.degree = static_cast<int>(xCoeffs.size()) - 1;
+    model.center = center;
+    model.scale = scale;
+    model.coeffs = substituteAffine(xCoeffs, scale, center);
+    return model;
+}
+
+// Матрица перехода c_x = M * c_t из базиса t = (x - center)/scale к степеням x:
+// M[j][k] = C(k, j) * (-center)^(k-j) / scale^k (разложение ((x - center)/scale)^k)
+std::vector<double> powerBasisMatrix(int degree, double center, double scale)
+{
+    const int size = degree + 1;
+    std::vector<double> M(size * size, 0.0);
+    for (int k = 0; k < size; ++k)
+    {
+        double binom = 1.0;
+        for (int j = k; j >= 0; --j)
+        {
+            M[j * size + k] = binom * std::pow(-center, k - j) / std::pow(scale, k);
+            binom = binom * j / (k - j + 1); // C(k, j-1) из C(k, j)
+        }
+    }
+    return M;
+}
+
+// Коэффициенты модели при x^0..x^degree, в double
+std::vector<double> polyCoeffsInX(const PolyModel& model)
+{
+    const int size = static_cast<int>(model.coeffs.size());
+    std::vector<double> M = powerBasisMatrix(size - 1, model.center, model.scale);
+    std::vector<double> xCoeffs(size, 0.0);
+    for (int j = 0; j < size; ++j)
+        for (int k = j; k < size; ++k)
+            xCoeffs[j] += M[j * size + k] * model.coeffs[k];
+    return xCoeffs;
+}
+
+// ----------------------------------------
+// Небольшие плотные системы: разложение Холецкого
+// ----------------------------------------
+
+// A (n x n, по строкам) заменяется нижним множителем L, A = L*L^T.
+// false, если матрица вырождена или не положительно определена.
+bool choleskyDecompose(std::vector<double>& A, int n)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = 0; j <= i; ++j)
+        {
+            double s = A[i * n + j];
+            for (int k = 0; k < j; ++k)
+                s -= A[i * n + k] * A[j * n + k];
+
+            if (i == j)
+            {
+                if (!(s > 1e-13 * std::fabs(A[i * n + i])))
+                    return false;
+                A[i * n + i] = std::sqrt(s);
+            }
+            else
+            {
+                A[i * n + j] = s / A[j * n + j];
+            }
+        }
+        for (int j = i + 1; j < n; ++j)
+            A[i * n + j] = 0.0;
+    }
+    return true;
+}
+
+// Решает L*L^T*x = b, результат записывается в b
+void choleskySolve(const std::vector<double>& L, int n, std::vector<double>& b)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        double s = b[i];
+        for (int k = 0; k < i; ++k)
+            s -= L[i * n + k] * b[k];
+        b[i] = s / L[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; --i)
+    {
+        double s = b[i];
+        for (int k = i + 1; k < n; ++k)
+            s -= L[k * n + i] * b[k];
+        b[i] = s / L[i * n + i];
+    }
+}
+
+// (L*L^T)^-1 по столбцам единичной матрицы
+std::vector<double> choleskyInverse(const std::vector<double>& L, int n)
+{
+    std::vector<double> inv(n * n, 0.0);
+    std::vector<double> col(n);
+    for (int j = 0; j < n; ++j)
+    {
+        std::fill(col.begin(), col.end(), 0.0);
+        col[j] = 1.0;
+        choleskySolve(L, n, col);
+        for (int i = 0; i < n; ++i)
+            inv[i * n + j] = col[i];
+    }
+    return inv;
+}
+
+// Собственные числа и векторы симметричной матрицы методом Якоби.
+// vectors[i*n + k] - i-я компонента k-го собственного вектора.
+void symmetricEigen(std::vector<double> A, int n, std::vector<double>& values, std::vector<double>& vectors)
+{
+    vectors.assign(n * n, 0.0);
+    for (int i = 0; i < n; ++i)
+        vectors[i * n + i] = 1.0;
+
+    for (int sweep = 0; sweep < 100; ++sweep)
+    {
+        double off = 0.0, diag = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            diag += A[i * n + i] * A[i * n + i];
+            for (int j = i + 1; j < n; ++j)
+                off += A[i * n + j] * A[i * n + j];
+        }
+        if (off <= 1e-30 * diag)
+            break;
+
+        for (int p = 0; p < n; ++p)
+        {
+            for (int q = p + 1; q < n; ++q)
+            {
+                double apq = A[p * n + q];
+                if (apq == 0.0)
+                    continue;
+                // Поворот, зануляющий A[p][q]
+                double theta = (A[q * n + q] - A[p * n + p]) / (2.0 * apq);
+                double t = ((theta >= 0.0) ? 1.0 : -1.0) / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+                double c = 1.0 / std::sqrt(t * t + 1.0);
+                double sn = t * c;
+                for (int k = 0; k < n; ++k)
+                {
+                    double akp = A[k * n + p], akq = A[k * n + q];
+                    A[k * n + p] = c * akp - sn * akq;
+                    A[k * n + q] = sn * akp + c * akq;
+                }
+                for (int k = 0; k < n; ++k)
+                {
+                    double apk = A[p * n + k], aqk = A[q * n + k];
+                    A[p * n + k] = c * apk - sn * aqk;
+                    A[q * n + k] = sn * apk + c * aqk;
+                }
+                for (int k = 0; k < n; ++k)
+                {
+                    double vkp = vectors[k * n + p], vkq = vectors[k * n + q];
+                    vectors[k * n + p] = c * vkp - sn * vkq;
+                    vectors[k * n + q] = sn * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    values.resize(n);
+    for (int i = 0; i < n; ++i)
+        values[i] = A[i * n + i];
+}
+
+// ----------------------------------------
+// Решение по моментам и перекрёстная проверка
+// ----------------------------------------
+
+// total - part: моменты всех точек, кроме части
+PowerMoments subtractMoments(const PowerMoments& total, const PowerMoments& part)
+{
+    PowerMoments r = total;
+    for (size_t k = 0; k < r.St.size(); ++k)
+        r.St[k] -= part.St[k];
+    for (size_t k = 0; k < r.Sty.size(); ++k)
+        r.Sty[k] -= part.Sty[k];
+    r.Syy -= part.Syy;
+    return r;
+}
+
+// Полином степени degree по моментам. Если inverseNormal задан,
+// туда кладётся (X^T X)^-1 в масштабированной переменной t.
+bool solvePolynomialFromMoments(const PowerMoments& m, int degree, PolyModel& model,
+                                std::vector<double>* inverseNormal = nullptr)
+{
+    int size = degree + 1;
+    if (degree < 0 || degree > m.maxDegree || m.St[0] < size)
+        return false;
+
+    std::vector<double> G(size * size);
+    for (int i = 0; i < size; ++i)
+        for (int j = 0; j < size; ++j)
+            G[i * size + j] = m.St[i + j];
+    if (!choleskyDecompose(G, size))
+        return false;
+
+    model.degree = degree;
+    model.center = m.center;
+    model.scale = m.scale;
+    model.coeffs.assign(m.Sty.begin(), m.Sty.begin() + size);
+    choleskySolve(G, size, model.coeffs);
+
+    if (inverseNormal)
+        *inverseNormal = choleskyInverse(G, size);
+    return true;
+}
+
+// Сумма квадратов остатков модели на точках, заданных моментами:
+// sum (y - c^T phi)^2 = Syy - 2 c^T b + c^T G c, без прохода по данным
+double residualSumFromMoments(const PowerMoments& m, const PolyModel& model)
+{
+    int size = static_cast<int>(model.coeffs.size());
+    double cb = 0.0, cGc = 0.0;
+    for (int i = 0; i < size; ++i)
+    {
+        cb += model.coeffs[i] * m.Sty[i];
+        for (int j = 0; j < size; ++j)
+            cGc += model.coeffs[i] * model.coeffs[j] * m.St[i + j];
+    }
+    return std::max(m.Syy - 2.0 * cb + cGc, 0.0);
+}
+
+// ----------------------------------------
+// Взвешенный МНК: прямая и парабола по взвешенным моментам
+// ----------------------------------------
+
+// Взвешенная линейная регрессия (веса - Point::w) тем же блочным проходом моментов;
+// moments (если задан) получает моменты этого прохода
+std::pair<float, float> computeWeightedLinearRegression(const std::vector<Point>& points,
+                                                        PowerMoments* moments = nullptr)
+{
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    PowerMoments m = accumulatePowerMomentsParallel(points, nullptr, 1, center, scale);
+    if (moments)
+        *moments = m;
+    PolyModel model;
+    if (!solvePolynomialFromMoments(m, 1, model))
+    {
+        // Одна точка или все X совпадают: горизонтальная прямая через взвешенное среднее
+        float meanY = (m.St[0] > 0.0) ? static_cast<float>(m.Sty[0] / m.St[0]) : 0.f;
+        return {0.f, meanY};
+    }
+
+    // y = c0 + c1 * (x - center) / scale
+    double slope = model.coeffs[1] / scale;
+    double intercept = model.coeffs[0] - slope * center;
+    return {static_cast<float>(slope), static_cast<float>(intercept)};
+}
+
+// Взвешенная парабола: решение в масштабированной переменной и перевод в a, b, c
+Poly2Coeffs computeWeightedPolynomialRegression2(const std::vector<Point>& points,
+                                                 PowerMoments* moments = nullptr)
+{
+    Poly2Coeffs coeffs{0.f, 0.f, 0.f};
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    PowerMoments m = accumulatePowerMomentsParallel(points, nullptr, 2, center, scale);
+    if (moments)
+        *moments = m;
+    PolyModel model;
+    if (!solvePolynomialFromMoments(m, 2, model))
+        return coeffs;
+
+    // c0 + c1*t + c2*t^2, t = (x - center) / scale
+    double c1 = model.coeffs[1] / scale;
+    double c2 = model.coeffs[2] / (scale * scale);
+    coeffs.a = static_cast<float>(c2);
+    coeffs.b = static_cast<float>(c1 - 2.0 * c2 * center);
+    coeffs.c = static_cast<float>(model.coeffs[0] - c1 * center + c2 * center * center);
+    return coeffs;
+}
+
+// Итоги перекрёстной проверки
+struct CrossValidationResult
+{
+    int folds = 0;
+    double mse = 0.0;
+    double rmse = 0.0;
+    std::vector<double> foldMse;
+};
+
+// Модель как функция x -> y и процедура её подгонки
+using Predictor = std::function<float(float)>;
+using ModelFitter = std::function<Predictor(const std::vector<Point>&)>;
+
+// Перемешивание с фиксированным зерном: фолды воспроизводимы от запуска к запуску
+std::vector<Point> shuffledForFolds(const std::vector<Point>& points)
+{
+    std::vector<Point> shuffled = points;
+    std::mt19937 rng(12345);
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+    return shuffled;
+}
+
+// Граница фолда f из folds на count точках
+size_t foldBoundary(size_t count, int folds, int f)
+{
+    return count * static_cast<size_t>(f) / static_cast<size_t>(folds);
+}
+
+// k-fold для полинома степени degree (linear = 1, poly2 = 2).
+// Моменты считаются по каждому фолду параллельно; модель фолда решается по
+// моментам "всё минус фолд", а ошибка на фолде - по его же моментам.
+CrossValidationResult crossValidatePolynomial(const std::vector<Point>& points, int degree, int folds)
+{
+    CrossValidationResult result;
+    folds = std::min<int>(folds, static_cast<int>(points.size()));
+    if (folds < 2)
+        return result;
+
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    std::vector<Point> shuffled = shuffledForFolds(points);
+
+    std::vector<PowerMoments> foldMoments(folds);
+    globalThreadPool().parallelFor(folds, [&](size_t f)
+    {
+        size_t lo = foldBoundary(shuffled.size(), folds, static_cast<int>(f));
+        size_t hi = foldBoundary(shuffled.size(), folds, static_cast<int>(f) + 1);
+        foldMoments[f] = accumulatePowerMoments(shuffled.data() + lo, hi - lo, degree, center, scale);
+    });
+
+    PowerMoments total = foldMoments[0];
+    for (int f = 1; f < folds; ++f)
+        addMoments(total, foldMoments[f]);
+
+    double sse = 0.0, count = 0.0;
+    result.folds = folds;
+    for (int f = 0; f < folds; ++f)
+    {
+        PolyModel model;
+        PowerMoments train = subtractMoments(total, foldMoments[f]);
+        if (!solvePolynomialFromMoments(train, degree, model))
+            return CrossValidationResult{};
+        double foldSse = residualSumFromMoments(foldMoments[f], model);
+        double foldN = foldMoments[f].St[0];
+        result.foldMse.push_back(foldN > 0.0 ? foldSse / foldN : 0.0);
+        sse += foldSse;
+        count += foldN;
+    }
+    result.mse = sse / count;
+    result.rmse = std::sqrt(result.mse);
+    return result;
+}
+
+// Leave-one-out без N переподгонок: остаток без точки i равен r_i / (1 - h_ii),
+// где h_ii = w_i * phi_i^T (X^T W X)^-1 phi_i - диагональ матрицы-шляпы.
+CrossValidationResult leaveOneOutPolynomial(const std::vector<Point>& points, int degree)
+{
+    CrossValidationResult result;
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    PowerMoments m = accumulatePowerMoments(points, degree, center, scale);
+
+    PolyModel model;
+    std::vector<double> inv;
+    if (!solvePolynomialFromMoments(m, degree, model, &inv))
+        return result;
+
+    const int size = degree + 1;
+    const size_t kChunk = 4096;
+    size_t chunks = (points.size() + kChunk - 1) / kChunk;
+    std::vector<double> chunkPress(chunks, 0.0);
+    globalThreadPool().parallelFor(chunks, [&](size_t c)
+    {
+        size_t hi = std::min(points.size(), (c + 1) * kChunk);
+        std::vector<double> phi(size);
+        double press = 0.0;
+        for (size_t i = c * kChunk; i < hi; ++i)
+        {
+            double t = (points[i].x - center) / scale;
+            phi[0] = 1.0;
+            for (int k = 1; k < size; ++k)
+                phi[k] = phi[k - 1] * t;
+
+            double h = 0.0, pred = 0.0;
+            for (int a = 0; a < size; ++a)
+            {
+                pred += model.coeffs[a] * phi[a];
+                double row = 0.0;
+                for (int b = 0; b < size; ++b)
+                    row += inv[a * size + b] * phi[b];
+                h += phi[a] * row;
+            }
+            h *= points[i].w;
+            // h ~ 1: точка сама определяет модель, её LOO-ошибка не определена
+            if (h < 1.0 - 1e-10)
+            {
+                double r = (points[i].y - pred) / (1.0 - h);
+                press += points[i].w * r * r;
+            }
+        }
+        chunkPress[c] = press;
+    });
+
+    double press = 0.0;
+    for (double p : chunkPress)
+        press += p;
+    result.folds = static_cast<int>(points.size());
+    result.mse = press / m.St[0];
+    result.rmse = std::sqrt(result.mse);
+    return result;
+}
+
+// k-fold для моделей без моментной формы: каждый фолд переподгоняется заново,
+// фолды выполняются параллельно. folds = N даёт leave-one-out.
+// Выше kMaxRefitLOO точек LOO с переподгонкой не запускается: N подгонок RANSAC,
+// Тейла-Сена или LM в потоке окна длились бы часами, остаётся только k-fold.
+const size_t kMaxRefitLOO = 200;
+
+CrossValidationResult crossValidateWithRefit(const std::vector<Point>& points, int folds,
+                                             const ModelFitter& fit)
+{
+    CrossValidationResult result;
+    folds = std::min<int>(folds, static_cast<int>(points.size()));
+    if (folds < 2)
+        return result;
+
+    std::vector<Point> shuffled = shuffledForFolds(points);
+    std::vector<double> foldSse(folds, 0.0), foldWeight(folds, 0.0);
+    globalThreadPool().parallelFor(folds, [&](size_t f)
+    {
+        size_t lo = foldBoundary(shuffled.size(), folds, static_cast<int>(f));
+        size_t hi = foldBoundary(shuffled.size(), folds, static_cast<int>(f) + 1);
+        std::vector<Point> train;
+        train.reserve(shuffled.size() - (hi - lo));
+        train.insert(train.end(), shuffled.begin(), shuffled.begin() + lo);
+        train.insert(train.end(), shuffled.begin() + hi, shuffled.end());
+
+        Predictor predict = fit(train);
+        double sse = 0.0, weight = 0.0;
+        for (size_t i = lo; i < hi; ++i)
+        {
+            double r = shuffled[i].y - predict(shuffled[i].x);
+            sse += shuffled[i].w * r * r;
+            weight += shuffled[i].w;
+        }
+        foldSse[f] = sse;
+        foldWeight[f] = weight;
+    });
+
+    double sse = 0.0, weight = 0.0;
+    result.folds = folds;
+    for (int f = 0; f < folds; ++f)
+    {
+        result.foldMse.push_back(foldWeight[f] > 0.0 ? foldSse[f] / foldWeight[f] : 0.0);
+        sse += foldSse[f];
+        weight += foldWeight[f];
+    }
+    result.mse = sse / weight;
+    result.rmse = std::sqrt(result.mse);
+    return result;
+}
+
+// ----------------------------------------
+// Робастная регрессия: IRLS (Huber, Tukey) и RANSAC
+// ----------------------------------------
+
+// Функция потерь для IRLS
+enum class RobustLoss
+{
+    HUBER,
+    TUKEY
+};
+
+// Размер куска для параллельных проходов по точкам
+const size_t kParallelChunk = 65536;
+
+// Остатки y - model(x) для всех точек
+void computeResiduals(const std::vector<Point>& points, const PolyModel& model,
+                      std::vector<double>& residuals)
+{
+    residuals.resize(points.size());
+    parallelForChunks(points.size(), kParallelChunk, [&](size_t, size_t lo, size_t hi)
+    {
+        for (size_t i = lo; i < hi; ++i)
+            residuals[i] = points[i].y - evaluatePolyModel(model, points[i].x);
+    });
+}
+
+// Робастная оценка сигмы остатков: MAD / 0.6745.
+// При нетривиальных весах точек медиана взвешенная.
+double robustScale(const std::vector<double>& residuals, const std::vector<Point>& points)
+{
+    if (residuals.empty())
+        return 0.0;
+    bool weighted = std::any_of(points.begin(), points.end(), [](const Point& p) { return p.w != 1.f; });
+    if (!weighted)
+    {
+        std::vector<double> absRes(residuals.size());
+        for (size_t i = 0; i < residuals.size(); ++i)
+            absRes[i] = std::fabs(residuals[i]);
+        auto mid = absRes.begin() + absRes.size() / 2;
+        std::nth_element(absRes.begin(), mid, absRes.end());
+        return *mid / 0.6745;
+    }
+
+    std::vector<std::pair<double, double>> absRes(residuals.size());
+    double total = 0.0;
+    for (size_t i = 0; i < residuals.size(); ++i)
+    {
+        absRes[i] = {std::fabs(residuals[i]), points[i].w};
+        total += points[i].w;
+    }
+    std::sort(absRes.begin(), absRes.end());
+    double acc = 0.0;
+    for (auto& [r, w] : absRes)
+    {
+        acc += w;
+        if (acc >= 0.5 * total)
+            return r / 0.6745;
+    }
+    return absRes.back().first / 0.6745;
+}
+
+// Наименьшие квадраты степени degree (стартовая точка для IRLS)
+PolyModel computeLeastSquaresPoly(const std::vector<Point>& points, int degree, const double* weights = nullptr)
+{
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    PowerMoments m = accumulatePowerMomentsParallel(points, weights, degree, center, scale);
+    PolyModel model;
+    if (!solvePolynomialFromMoments(m, degree, model))
+        return PolyModel{};
+    return model;
+}
+
+// IRLS: на каждой итерации веса по остаткам и один взвешенный проход моментов.
+// Tukey невыпуклая, поэтому стартует с решения Huber.
+PolyModel computeRobustRegressionIRLS(const std::vector<Point>& points, int degree, RobustLoss loss,
+                                      int maxIterations = 50)
+{
+    PolyModel model = (loss == RobustLoss::TUKEY)
+        ? computeRobustRegressionIRLS(points, degree, RobustLoss::HUBER, maxIterations)
+        : computeLeastSquaresPoly(points, degree);
+    if (model.coeffs.empty())
+        return model;
+
+    // Стандартные константы настройки (95% эффективности при нормальном шуме)
+    const double tuning = (loss == RobustLoss::HUBER) ? 1.345 : 4.685;
+    std::vector<double> residuals, weights(points.size());
+
+    for (int iter = 0; iter < maxIterations; ++iter)
+    {
+        computeResiduals(points, model, residuals);
+        double sigma = robustScale(residuals, points);
+        if (sigma <= 0.0)
+            break; // больше половины точек лежит точно на модели
+        double invCutoff = 1.0 / (tuning * sigma);
+
+        parallelForChunks(points.size(), kParallelChunk, [&](size_t, size_t lo, size_t hi)
+        {
+            for (size_t i = lo; i < hi; ++i)
+            {
+                double u = std::fabs(residuals[i]) * invCutoff;
+                if (loss == RobustLoss::HUBER)
+                    weights[i] = (u <= 1.0) ? 1.0 : 1.0 / u;
+                else
+                    weights[i] = (u < 1.0) ? (1.0 - u * u) * (1.0 - u * u) : 0.0;
+            }
+        });
+
+        PowerMoments m = accumulatePowerMomentsParallel(points, weights.data(), degree,
+                                                        model.center, model.scale);
+        PolyModel next;
+        if (!solvePolynomialFromMoments(m, degree, next))
+            break;
+
+        double change = 0.0, norm = 0.0;
+        for (int k = 0; k <= degree; ++k)
+        {
+            change = std::max(change, std::fabs(next.coeffs[k] - model.coeffs[k]));
+            norm = std::max(norm, std::fabs(next.coeffs[k]));
+        }
+        model = next;
+        if (change <= 1e-9 * std::max(norm, 1.0))
+            break;
+    }
+    return model;
+}
+
+// RANSAC: гипотезы по минимальным выборкам (degree+1 точек) проверяются параллельно
+// раундами. У каждой гипотезы свой генератор с зерном по её номеру, поэтому результат
+// не зависит от числа потоков. Число раундов сокращается по доле инлайеров лучшей
+// гипотезы; проверка гипотезы прерывается, когда она уже не может обогнать лучшую.
+PolyModel computeRansacRegression(const std::vector<Point>& points, int degree,
+                                  int maxHypotheses = 2000, double confidence = 0.99)
+{
+    const int sampleSize = degree + 1;
+    const size_t n = points.size();
+    if (n <= static_cast<size_t>(sampleSize))
+        return computeLeastSquaresPoly(points, degree);
+
+    // Порог инлайера: 2.5 робастной сигмы остатков МНК
+    PolyModel ls = computeLeastSquaresPoly(points, degree);
+    if (ls.coeffs.empty())
+        return ls;
+    std::vector<double> residuals;
+    computeResiduals(points, ls, residuals);
+    double threshold = 2.5 * robustScale(residuals, points);
+    if (threshold <= 0.0)
+        return ls;
+
+    // Инлайеры считаются суммарным весом точек
+    double totalWeight = 0.0;
+    for (auto& p : points)
+        totalWeight += p.w;
+
+    const int kRound = 64;
+    std::atomic<double> bestCount{0.0};
+    double bestInliers = 0.0;
+    int bestHypothesis = -1;
+    PolyModel bestModel;
+    int required = maxHypotheses;
+
+    for (int roundStart = 0; roundStart < required; roundStart += kRound)
+    {
+        int roundSize = std::min(kRound, required - roundStart);
+        std::vector<PolyModel> models(roundSize);
+        std::vector<double> counts(roundSize, 0.0);
+
+        globalThreadPool().parallelFor(roundSize, [&](size_t h)
+        {
+            std::mt19937 rng(1000003u * static_cast<unsigned>(roundStart + h) + 17u);
+            std::uniform_int_distribution<size_t> pick(0, n - 1);
+            std::vector<Point> sample;
+            for (int attempt = 0; attempt < 32 * sampleSize && static_cast<int>(sample.size()) < sampleSize; ++attempt)
+            {
+                const Point& p = points[pick(rng)];
+                bool duplicateX = false;
+                for (auto& q : sample)
+                    duplicateX = duplicateX || (q.x == p.x);
+                if (!duplicateX)
+                    sample.push_back(p);
+            }
+            if (static_cast<int>(sample.size()) < sampleSize)
+                return; // точек с разными X не хватает
+
+            PowerMoments m = accumulatePowerMoments(sample, degree, ls.center, ls.scale);
+            PolyModel candidate;
+            if (!solvePolynomialFromMoments(m, degree, candidate))
+                return;
+
+            double inliers = 0.0, processed = 0.0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                if (std::fabs(points[i].y - evaluatePolyModel(candidate, points[i].x)) <= threshold)
+                    inliers += points[i].w;
+                processed += points[i].w;
+                // Раннее прекращение: даже все оставшиеся точки не дадут победы
+                if ((i & 4095) == 4095 &&
+                    inliers + (totalWeight - processed) < bestCount.load(std::memory_order_relaxed))
+                    return;
+            }
+            counts[h] = inliers;
+            models[h] = candidate;
+
+            double seen = bestCount.load(std::memory_order_relaxed);
+            while (inliers > seen && !bestCount.compare_exchange_weak(seen, inliers))
+                ;
+        });
+
+        // Лучшая гипотеза раунда; при равенстве побеждает меньший номер
+        for (int h = 0; h < roundSize; ++h)
+        {
+            if (counts[h] > bestInliers)
+            {
+                bestInliers = counts[h];
+                bestHypothesis = roundStart + h;
+                bestModel = models[h];
+            }
+        }
+
+        // Нужное число гипотез: log(1 - confidence) / log(1 - w^s)
+        if (bestInliers > 0)
+        {
+            double w = bestInliers / totalWeight;
+            double allInliers = std::pow(w, sampleSize);
+            if (allInliers >= 1.0 - 1e-12)
+                break;
+            double needed = std::log(1.0 - confidence) / std::log(1.0 - allInliers);
+            required = std::min(maxHypotheses, std::max(kRound, static_cast<int>(std::ceil(needed))));
+        }
+    }
+    if (bestHypothesis < 0)
+        return ls;
+
+    // Итог: МНК по инлайерам лучшей гипотезы
+    std::vector<Point> inlierPoints;
+    for (auto& p : points)
+    {
+        if (std::fabs(p.y - evaluatePolyModel(bestModel, p.x)) <= threshold)
+            inlierPoints.push_back(p);
+    }
+    PowerMoments m = accumulatePowerMoments(inlierPoints, degree, ls.center, ls.scale);
+    PolyModel refined;
+    if (!solvePolynomialFromMoments(m, degree, refined))
+        return bestModel;
+    return refined;
+}
+
+// ----------------------------------------
+// Множественная линейная регрессия по столбцам CSV
+// ----------------------------------------
+
+// Таблица по столбцам (SoA): columns[j][i] - значение столбца j в строке i
+struct ColumnStore
+{
+    std::vector<std::string> names;
+    std::vector<std::vector<double>> columns;
+    size_t rows = 0;
+};
+
+// y = intercept + sum coeffs[j] * x_j
+struct MultivariateModel
+{
+    std::vector<int> featureColumns;
+    int targetColumn = -1;
+    double intercept = 0.0;
+    std::vector<double> coeffs;
+    double r2 = 0.0;
+};
+
+// Разбивает строку CSV по ',' или ';'
+std::vector<std::string> splitCSVLine(const std::string& line)
+{
+    std::vector<std::string> cells;
+    std::string cell;
+    for (char ch : line)
+    {
+        if (ch == ',' || ch == ';')
+        {
+            cells.push_back(cell);
+            cell.clear();
+        }
+        else if (ch != '\r')
+        {
+            cell += ch;
+        }
+    }
+    cells.push_back(cell);
+    return cells;
+}
+
+// Число из ячейки целиком: "12abc" или "1.5.2" - не число (пробелы по краям допустимы)
+bool parseWholeDouble(const std::string& cell, double& value)
+{
+    const char* begin = cell.c_str();
+    char* end = nullptr;
+    value = std::strtod(begin, &end);
+    if (end == begin)
+        return false;
+    while (*end != '\0' && std::isspace(static_cast<unsigned char>(*end)))
+        ++end;
+    return *end == '\0';
+}
+
+// Загрузка всех числовых столбцов. Первая строка считается заголовком,
+// если в ней есть нечисловые ячейки; строки с другим числом ячеек пропускаются.
+ColumnStore loadColumnsFromCSV(const std::string& filename)
+{
+    ColumnStore store;
+    std::ifstream file(filename);
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Unable to open file " << filename << std::endl;
+        return store;
+    }
+
+    std::string line;
+    std::vector<double> row;
+    bool first = true;
+    while (std::getline(file, line))
+    {
+        if (line.empty())
+            continue;
+        std::vector<std::string> cells = splitCSVLine(line);
+
+        row.clear();
+        bool numeric = true;
+        for (auto& c : cells)
+        {
+            double v;
+            if (!parseWholeDouble(c, v))
+            {
+                numeric = false;
+                break;
+            }
+            row.push_back(v);
+        }
+
+        if (first)
+        {
+            first = false;
+            store.columns.resize(cells.size());
+            for (size_t j = 0; j < cells.size(); ++j)
+                store.names.push_back(numeric ? "col" + std::to_string(j) : cells[j]);
+            if (!numeric)
+                continue;
+        }
+        if (!numeric || row.size() != store.columns.size())
+            continue;
+
+        for (size_t j = 0; j < row.size(); ++j)
+            store.columns[j].push_back(row[j]);
+        ++store.rows;
+    }
+    return store;
+}
+
+// Число диапазонов строк для параллельной сборки X^T X. Фиксировано, а не равно
+// числу потоков, чтобы порядок сложения (и результат) не зависел от машины.
+const size_t kGramRanges = 64;
+
+// Расширенная матрица Грама [1 X y]^T [1 X y] размера (p+2) x (p+2).
+// Значения сдвигаются на первую строку таблицы: это не меняет регрессию
+// со свободным членом, но убирает потерю точности при больших X.
+// Строки обрабатываются блоками: блок всех столбцов копируется в локальный буфер
+// (помещается в L2), затем попарные скалярные произведения идут по непрерывной памяти.
+std::vector<double> buildAugmentedGram(const ColumnStore& store, const std::vector<int>& featureColumns,
+                                       int targetColumn, std::vector<double>& shift)
+{
+    const int p = static_cast<int>(featureColumns.size());
+    const int dim = p + 2;
+    std::vector<const double*> cols(p + 1);
+    for (int j = 0; j < p; ++j)
+        cols[j] = store.columns[featureColumns[j]].data();
+    cols[p] = store.columns[targetColumn].data();
+
+    shift.assign(p + 1, 0.0);
+    if (store.rows > 0)
+        for (int j = 0; j <= p; ++j)
+            shift[j] = cols[j][0];
+
+    size_t ranges = std::min(kGramRanges, std::max<size_t>(1, store.rows / 1024));
+    std::vector<std::vector<double>> partial(ranges);
+    globalThreadPool().parallelFor(ranges, [&](size_t r)
+    {
+        const size_t kRows = 128;
+        size_t lo = store.rows * r / ranges;
+        size_t hi = store.rows * (r + 1) / ranges;
+        std::vector<double>& G = partial[r];
+        G.assign(dim * dim, 0.0);
+        std::vector<double> buf((p + 1) * kRows);
+
+        for (size_t r0 = lo; r0 < hi; r0 += kRows)
+        {
+            size_t len = std::min(kRows, hi - r0);
+            for (int j = 0; j <= p; ++j)
+            {
+                double* dst = &buf[j * kRows];
+                const double* src = cols[j] + r0;
+                double sj = shift[j];
+                double sum = 0.0;
+                for (size_t i = 0; i < len; ++i)
+                {
+                    dst[i] = src[i] - sj;
+                    sum += dst[i];
+                }
+                G[j + 1] += sum; // строка свободного члена
+            }
+            G[0] += static_cast<double>(len);
+
+            for (int j = 0; j <= p; ++j)
+            {
+                const double* a = &buf[j * kRows];
+                for (int k = j; k <= p; ++k)
+                {
+                    const double* b = &buf[k * kRows];
+                    double sum = 0.0;
+                    for (size_t i = 0; i < len; ++i)
+                        sum += a[i] * b[i];
+                    G[(j + 1) * dim + (k + 1)] += sum;
+                }
+            }
+        }
+    });
+
+    std::vector<double> G(dim * dim, 0.0);
+    for (auto& part : partial)
+        for (int i = 0; i < dim * dim; ++i)
+            G[i] += part[i];
+    // Симметричная половина
+    for (int j = 0; j < dim; ++j)
+        for (int k = 0; k < j; ++k)
+            G[j * dim + k] = G[k * dim + j];
+    return G;
+}
+
+// Подгонка y = intercept + X*beta: матрица Грама за один параллельный проход,
+// затем Холецкий с предварительным выравниванием диагонали.
+bool fitMultivariateRegression(const ColumnStore& store, const std::vector<int>& featureColumns,
+                               int targetColumn, MultivariateModel& model)
+{
+    const int p = static_cast<int>(featureColumns.size());
+    const int size = p + 1;
+    const int dim = p + 2;
+    if (store.rows <= static_cast<size_t>(size))
+        return false;
+
+    std::vector<double> shift;
+    std::vector<double> G = buildAugmentedGram(store, featureColumns, targetColumn, shift);
+
+    // A = X^T X, b = X^T y, диагональное масштабирование D^-1/2 A D^-1/2
+    std::vector<double> A(size * size), b(size), d(size);
+    for (int i = 0; i < size; ++i)
+        d[i] = (G[i * dim + i] > 0.0) ? 1.0 / std::sqrt(G[i * dim + i]) : 1.0;
+    for (int i = 0; i < size; ++i)
+    {
+        for (int j = 0; j < size; ++j)
+            A[i * size + j] = G[i * dim + j] * d[i] * d[j];
+        b[i] = G[i * dim + (dim - 1)] * d[i];
+    }
+    if (!choleskyDecompose(A, size))
+        return false;
+    choleskySolve(A, size, b);
+    for (int i = 0; i < size; ++i)
+        b[i] *= d[i];
+
+    model.featureColumns = featureColumns;
+    model.targetColumn = targetColumn;
+    model.coeffs.assign(b.begin() + 1, b.end());
+    model.intercept = b[0] + shift[p];
+    for (int j = 0; j < p; ++j)
+        model.intercept -= b[j + 1] * shift[j];
+
+    // R^2 по той же матрице: RSS = y^T y - beta^T X^T y
+    double n = G[0];
+    double sy = G[dim - 1];
+    double yy = G[(dim - 1) * dim + (dim - 1)];
+    double explained = 0.0;
+    for (int i = 0; i < size; ++i)
+        explained += b[i] * G[i * dim + (dim - 1)];
+    double tss = yy - sy * sy / n;
+    model.r2 = (tss > 0.0) ? 1.0 - std::max(yy - explained, 0.0) / tss : 1.0;
+    return true;
+}
+
+// Предсказание для всех строк: по кускам строк, внутри - axpy по столбцам
+void predictMultivariate(const MultivariateModel& model, const ColumnStore& store, std::vector<double>& out)
+{
+    out.assign(store.rows, model.intercept);
+    parallelForChunks(store.rows, 8192, [&](size_t, size_t lo, size_t hi)
+    {
+        double* dst = out.data();
+        for (size_t j = 0; j < model.coeffs.size(); ++j)
+        {
+            const double* col = store.columns[model.featureColumns[j]].data();
+            double beta = model.coeffs[j];
+            for (size_t i = lo; i < hi; ++i)
+                dst[i] += beta * col[i];
+        }
+    });
+}
+
+// Консольный режим --multi: все столбцы, кроме целевого, - признаки
+int runMultivariateCLI(const std::string& filename, const std::string& target)
+{
+    auto start = std::chrono::steady_clock::now();
+    ColumnStore store = loadColumnsFromCSV(filename);
+    if (store.columns.size() < 2 || store.rows == 0)
+    {
+        std::cerr << "Error: need at least two numeric columns in " << filename << std::endl;
+        return 1;
+    }
+
+    int targetColumn = static_cast<int>(store.columns.size()) - 1;
+    if (!target.empty())
+    {
+        auto it = std::find(store.names.begin(), store.names.end(), target);
+        if (it != store.names.end())
+        {
+            targetColumn = static_cast<int>(it - store.names.begin());
+        }
+        else
+        {
+            // Номер столбца принимается, только если строка - целое число целиком
+            char* end = nullptr;
+            long index = std::strtol(target.c_str(), &end, 10);
+            if (end == target.c_str() || *end != '\0' || index < 0 ||
+                index >= static_cast<long>(store.columns.size()))
+            {
+                std::cerr << "Error: unknown column " << target << std::endl;
+                return 1;
+            }
+            targetColumn = static_cast<int>(index);
+        }
+    }
+
+    std::vector<int> features;
+    for (int j = 0; j < static_cast<int>(store.columns.size()); ++j)
+        if (j != targetColumn)
+            features.push_back(j);
+
+    auto loaded = std::chrono::steady_clock::now();
+    MultivariateModel model;
+    if (!fitMultivariateRegression(store, features, targetColumn, model))
+    {
+        std::cerr << "Error: singular system (collinear features or too few rows)" << std::endl;
+        return 1;
+    }
+    auto fitted = std::chrono::steady_clock::now();
+
+    std::cout << "rows=" << store.rows << " features=" << features.size()
+              << " target=" << store.names[targetColumn] << std::endl;
+    std::cout << "intercept = " << model.intercept << std::endl;
+    for (size_t j = 0; j < features.size(); ++j)
+        std::cout << store.names[features[j]] << " = " << model.coeffs[j] << std::endl;
+    std::cout << "R2 = " << model.r2 << std::endl;
+
+    std::vector<double> predicted;
+    predictMultivariate(model, store, predicted);
+    const std::vector<double>& y = store.columns[targetColumn];
+    double sse = 0.0;
+    for (size_t i = 0; i < store.rows; ++i)
+        sse += (y[i] - predicted[i]) * (y[i] - predicted[i]);
+    std::cout << "RMSE = " << std::sqrt(sse / store.rows) << std::endl;
+    std::cout << "load " << std::chrono::duration<double>(loaded - start).count() << " s, fit "
+              << std::chrono::duration<double>(fitted - loaded).count() << " s" << std::endl;
+    return 0;
+}
+
+// ----------------------------------------
+// Регуляризованная полиномиальная регрессия: Ridge, Lasso, ElasticNet
+// ----------------------------------------
+
+// Признаки t, t^2, ..., t^degree, стандартизованные по моментам:
+// z_k = (t^k - mean_k) / sd_k. Все величины ниже - средние по точкам,
+// так что после одного прохода по данным путь регуляризации считается без данных.
+struct StandardizedMoments
+{
+    int degree = 0;
+    double center = 0.0;
+    double scale = 1.0;
+    double meanY = 0.0;
+    std::vector<double> mean;  // mean_k,  k = 1..degree (индекс k-1)
+    std::vector<double> sd;    // sd_k
+    std::vector<double> corr;  // корреляции z_j, z_k (degree x degree)
+    std::vector<double> cov;   // E[z_k * (y - meanY)]
+};
+
+// Путь регуляризации: модель для каждого lambda
+struct RegularizationPath
+{
+    std::vector<double> lambdas;
+    std::vector<PolyModel> models;
+    std::vector<int> nonZero; // число ненулевых коэффициентов (кроме свободного)
+};
+
+// Стандартизация по моментам степени не ниже degree
+StandardizedMoments standardizeMoments(const PowerMoments& m, int degree)
+{
+    StandardizedMoments s;
+    double n = m.St[0];
+    if (degree < 1 || degree > m.maxDegree || n <= 0.0)
+        return s;
+
+    s.degree = degree;
+    s.center = m.center;
+    s.scale = m.scale;
+    s.meanY = m.Sty[0] / n;
+    s.mean.resize(degree);
+    s.sd.resize(degree);
+    s.corr.assign(degree * degree, 0.0);
+    s.cov.resize(degree);
+
+    for (int k = 1; k <= degree; ++k)
+    {
+        s.mean[k - 1] = m.St[k] / n;
+        double var = m.St[2 * k] / n - s.mean[k - 1] * s.mean[k - 1];
+        s.sd[k - 1] = (var > 0.0) ? std::sqrt(var) : 1.0;
+    }
+    for (int j = 1; j <= degree; ++j)
+    {
+        for (int k = 1; k <= degree; ++k)
+        {
+            double c = m.St[j + k] / n - s.mean[j - 1] * s.mean[k - 1];
+            s.corr[(j - 1) * degree + (k - 1)] = c / (s.sd[j - 1] * s.sd[k - 1]);
+        }
+        double cy = m.Sty[j] / n - s.mean[j - 1] * s.meanY;
+        s.cov[j - 1] = cy / s.sd[j - 1];
+    }
+    return s;
+}
+
+// Из коэффициентов при стандартизованных признаках - обычный полином от t
+PolyModel modelFromStandardized(const StandardizedMoments& s, const std::vector<double>& beta)
+{
+    PolyModel model;
+    model.degree = s.degree;
+    model.center = s.center;
+    model.scale = s.scale;
+    model.coeffs.assign(s.degree + 1, 0.0);
+    model.coeffs[0] = s.meanY;
+    for (int k = 1; k <= s.degree; ++k)
+    {
+        double a = beta[k - 1] / s.sd[k - 1];
+        model.coeffs[k] = a;
+        model.coeffs[0] -= a * s.mean[k - 1];
+    }
+    return model;
+}
+
+// Геометрическая сетка lambda от maxLambda вниз до maxLambda * minRatio
+std::vector<double> makeLambdaGrid(double maxLambda, double minRatio, int count)
+{
+    std::vector<double> grid(count);
+    for (int i = 0; i < count; ++i)
+        grid[i] = maxLambda * std::pow(minRatio, count > 1 ? static_cast<double>(i) / (count - 1) : 0.0);
+    return grid;
+}
+
+// Ridge для всех lambda сразу: матрица корреляций раскладывается один раз,
+// R = V*E*V^T, а beta(lambda) = V * (V^T c / (e + lambda)) стоит O(degree^2).
+RegularizationPath computeRidgePath(const StandardizedMoments& s, const std::vector<double>& lambdas)
+{
+    RegularizationPath path;
+    const int d = s.degree;
+    if (d == 0)
+        return path;
+
+    std::vector<double> values, vectors;
+    symmetricEigen(s.corr, d, values, vectors);
+
+    // Проекции c на собственные векторы
+    std::vector<double> proj(d, 0.0);
+    for (int k = 0; k < d; ++k)
+        for (int i = 0; i < d; ++i)
+            proj[k] += vectors[i * d + k] * s.cov[i];
+
+    std::vector<double> beta(d);
+    for (double lambda : lambdas)
+    {
+        std::fill(beta.begin(), beta.end(), 0.0);
+        for (int k = 0; k < d; ++k)
+        {
+            double denom = std::max(values[k], 0.0) + lambda;
+            if (denom <= 0.0)
+                continue; // lambda = 0 и вырожденное направление
+            double w = proj[k] / denom;
+            for (int i = 0; i < d; ++i)
+                beta[i] += vectors[i * d + k] * w;
+        }
+        path.lambdas.push_back(lambda);
+        path.models.push_back(modelFromStandardized(s, beta));
+        path.nonZero.push_back(d);
+    }
+    return path;
+}
+
+// ElasticNet (alpha = 1 - Lasso) координатным спуском с ковариационными обновлениями:
+// градиент g = c - R*beta хранится целиком и после изменения beta_j на delta
+// корректируется столбцом R[:, j], так что шаг стоит O(degree) без прохода по данным.
+// Lambda идут от большего к меньшему, каждое решение - старт для следующего.
+RegularizationPath computeElasticNetPath(const StandardizedMoments& s, double alpha,
+                                         int count = 100, double minRatio = 1e-4)
+{
+    RegularizationPath path;
+    const int d = s.degree;
+    if (d == 0 || alpha <= 0.0)
+        return path;
+
+    // При lambda >= maxLambda все коэффициенты нулевые
+    double maxLambda = 0.0;
+    for (double c : s.cov)
+        maxLambda = std::max(maxLambda, std::fabs(c));
+    maxLambda /= alpha;
+    if (maxLambda <= 0.0)
+        maxLambda = 1.0;
+
+    std::vector<double> beta(d, 0.0);
+    std::vector<double> grad = s.cov;
+    for (double lambda : makeLambdaGrid(maxLambda, minRatio, count))
+    {
+        double l1 = lambda * alpha;
+        double denom = 1.0 + lambda * (1.0 - alpha);
+        for (int sweep = 0; sweep < 10000; ++sweep)
+        {
+            double maxDelta = 0.0;
+            for (int j = 0; j < d; ++j)
+            {
+                // Частичный остаток по признаку j (R[j][j] = 1)
+                double rho = grad[j] + beta[j];
+                double updated = 0.0;
+                if (rho > l1)
+                    updated = (rho - l1) / denom;
+                else if (rho < -l1)
+                    updated = (rho + l1) / denom;
+
+                double delta = updated - beta[j];
+                if (delta != 0.0)
+                {
+                    beta[j] = updated;
+                    for (int k = 0; k < d; ++k)
+                        grad[k] -= s.corr[k * d + j] * delta;
+                    maxDelta = std::max(maxDelta, std::fabs(delta));
+                }
+            }
+            if (maxDelta < 1e-9)
+                break;
+        }
+
+        int nonZero = 0;
+        for (double b : beta)
+            nonZero += (b != 0.0);
+        path.lambdas.push_back(lambda);
+        path.models.push_back(modelFromStandardized(s, beta));
+        path.nonZero.push_back(nonZero);
+    }
+    return path;
+}
+
+// Один проход по точкам и весь путь Ridge (ridge = true) или Lasso
+RegularizationPath computeRegularizationPath(const std::vector<Point>& points, int degree, bool ridge)
+{
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    PowerMoments m = accumulatePowerMomentsParallel(points, nullptr, degree, center, scale);
+    StandardizedMoments s = standardizeMoments(m, degree);
+    if (ridge)
+        return computeRidgePath(s, makeLambdaGrid(10.0, 1e-9, 100));
+    return computeElasticNetPath(s, 1.0);
+}
+
+// ----------------------------------------
+// Схлопывание повторяющихся точек во взвешенные
+// ----------------------------------------
+
+// Перемешивание битов ключа (финализатор splitmix64)
+inline uint64_t mixHash64(uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+// Одинаковые (x, y) объединяются в одну точку с суммарным весом.
+// Хеш-таблица с открытой адресацией (линейное пробирование) хранит индексы
+// уникальных точек; ёмкость - степень двойки не меньше 2N, так что цепочки короткие.
+// Порядок уникальных точек - порядок первого появления.
+std::vector<Point> collapseDuplicatePoints(const std::vector<Point>& points)
+{
+    size_t capacity = 16;
+    while (capacity < 2 * points.size())
+        capacity <<= 1;
+    const size_t mask = capacity - 1;
+
+    std::vector<int32_t> slots(capacity, -1);
+    std::vector<Point> unique;
+    unique.reserve(points.size() / 4 + 16);
+
+    for (auto& p : points)
+    {
+        // + 0.f превращает -0 в +0, чтобы равные значения имели равные биты
+        float x = p.x + 0.f;
+        float y = p.y + 0.f;
+        uint32_t bx, by;
+        std::memcpy(&bx, &x, sizeof(bx));
+        std::memcpy(&by, &y, sizeof(by));
+
+        size_t h = mixHash64((static_cast<uint64_t>(bx) << 32) | by) & mask;
+        for (;;)
+        {
+            int32_t idx = slots[h];
+            if (idx < 0)
+            {
+                slots[h] = static_cast<int32_t>(unique.size());
+                unique.push_back({x, y, p.w});
+                break;
+            }
+            if (unique[idx].x == x && unique[idx].y == y)
+            {
+                unique[idx].w += p.w;
+                break;
+            }
+            h = (h + 1) & mask;
+        }
+    }
+    return unique;
+}
+
+// ----------------------------------------
+// Точный целочисленный режим для целочисленных данных
+// ----------------------------------------
+
+// 128-битные целые (расширение GCC/Clang)
+typedef __int128 int128;
+
+// Целочисленные столбцы X, Y и веса
+struct IntegerColumns
+{
+    std::vector<int64_t> x;
+    std::vector<int64_t> y;
+    std::vector<int64_t> w;
+};
+
+// Границы значений, при которых блочные суммы w*x и w*y помещаются в int64.
+// Переполнение int128 в старших суммах проверяет exactSumsFit.
+const int64_t kMaxExactX = int64_t(1) << 24;
+const int64_t kMaxExactY = int64_t(1) << 31;
+const int64_t kMaxExactW = int64_t(1) << 20;
+
+// Разбор целого без потерь; false, если в ячейке не целое число
+bool parseInt64Cell(const std::string& cell, int64_t& value)
+{
+    const char* begin = cell.c_str();
+    char* end = nullptr;
+    long long v = std::strtoll(begin, &end, 10);
+    if (end == begin)
+        return false;
+    while (*end == ' ' || *end == '\t')
+        ++end;
+    if (*end != '\0')
+        return false;
+    value = v;
+    return true;
+}
+
+bool integerValuesInRange(int64_t x, int64_t y, int64_t w)
+{
+    return x >= -kMaxExactX && x <= kMaxExactX && y >= -kMaxExactY && y <= kMaxExactY &&
+           w > 0 && w <= kMaxExactW;
+}
+
+// Суммы w*x^4 и w*y^2 (с запасом на биномиальный сдвиг) не переполнят int128
+bool exactSumsFit(const IntegerColumns& c)
+{
+    long double maxX = 0.0L, maxY = 0.0L, totalW = 0.0L;
+    for (size_t i = 0; i < c.x.size(); ++i)
+    {
+        maxX = std::max(maxX, std::fabs(static_cast<long double>(c.x[i])));
+        maxY = std::max(maxY, std::fabs(static_cast<long double>(c.y[i])));
+        totalW += c.w[i];
+    }
+    const long double limit = std::ldexp(1.0L, 120);
+    long double x4 = maxX * maxX * maxX * maxX;
+    return x4 * totalW * 64.0L < limit && maxX * maxX * maxY * totalW * 64.0L < limit &&
+           maxY * maxY * totalW < limit;
+}
+
+// Чтение CSV сразу в int64, минуя float. false, если хоть одно значение
+// не целое или вне допустимого диапазона (тогда работает обычный путь).
+bool loadIntegerDataFromCSV(const std::string& filename, IntegerColumns& out)
+{
+    out = IntegerColumns{};
+    std::ifstream file(filename);
+    if (!file.is_open())
+        return false;
+
+    std::string line;
+    bool first = true;
+    while (std::getline(file, line))
+    {
+        if (line.empty())
+            continue;
+        std::vector<std::string> cells = splitCSVLine(line);
+        int64_t x, y, w = 1;
+        bool ok = cells.size() >= 2 && parseInt64Cell(cells[0], x) && parseInt64Cell(cells[1], y) &&
+                  (cells.size() < 3 || parseInt64Cell(cells[2], w));
+        if (!ok)
+        {
+            // Нечисловая первая строка - заголовок
+            if (first)
+            {
+                first = false;
+                continue;
+            }
+            return false;
+        }
+        first = false;
+        if (!integerValuesInRange(x, y, w))
+            return false;
+        out.x.push_back(x);
+        out.y.push_back(y);
+        out.w.push_back(w);
+    }
+    return !out.x.empty() && exactSumsFit(out);
+}
+
+// Целочисленные столбцы из точек после правок в окне; false, если есть дробные значения
+bool integerColumnsFromPoints(const std::vector<Point>& points, IntegerColumns& out)
+{
+    out = IntegerColumns{};
+    for (auto& p : points)
+    {
+        if (std::floor(p.x) != p.x || std::floor(p.y) != p.y || std::floor(p.w) != p.w)
+            return false;
+        int64_t x = static_cast<int64_t>(p.x);
+        int64_t y = static_cast<int64_t>(p.y);
+        int64_t w = static_cast<int64_t>(p.w);
+        if (!integerValuesInRange(x, y, w))
+            return false;
+        out.x.push_back(x);
+        out.y.push_back(y);
+        out.w.push_back(w);
+    }
+    return !out.x.empty() && exactSumsFit(out);
+}
+
+// Точные суммы: Sx[k] = sum w*x^k (k = 0..4), Sxy[k] = sum w*x^k*y (k = 0..2), Syy = sum w*y^2
+struct ExactMoments
+{
+    int128 Sx[5] = {0, 0, 0, 0, 0};
+    int128 Sxy[3] = {0, 0, 0};
+    int128 Syy = 0;
+};
+
+// Суммы по диапазону строк. Младшие суммы (w, w*x, w*y) копятся блоками в int64 -
+// эти циклы векторизуются. Для старших каждое произведение собрано из int64-множителей
+// так, чтобы по возможности хватало одного умножения 64x64 -> 128.
+void accumulateExactRange(const IntegerColumns& c, size_t lo, size_t hi, ExactMoments& m)
+{
+    const size_t kBlock = 1024; // |w*x| < 2^44, сумма блока < 2^54
+    for (size_t start = lo; start < hi; start += kBlock)
+    {
+        size_t end = std::min(hi, start + kBlock);
+        int64_t sw = 0, swx = 0, swy = 0;
+        for (size_t i = start; i < end; ++i)
+        {
+            sw  += c.w[i];
+            swx += c.w[i] * c.x[i];
+            swy += c.w[i] * c.y[i];
+        }
+        m.Sx[0] += sw;
+        m.Sx[1] += swx;
+        m.Sxy[0] += swy;
+
+        for (size_t i = start; i < end; ++i)
+        {
+            int64_t x = c.x[i];
+            int64_t y = c.y[i];
+            int64_t wx = c.w[i] * x;                 // < 2^44
+            int64_t x2 = x * x;                      // < 2^48
+            int128 wx2 = static_cast<int128>(wx) * x;
+            m.Sx[2]  += wx2;
+            m.Sx[3]  += static_cast<int128>(wx) * x2;
+            m.Sx[4]  += wx2 * x2;
+            m.Sxy[1] += static_cast<int128>(wx) * y;
+            m.Sxy[2] += static_cast<int128>(wx) * (x * y);
+            m.Syy    += static_cast<int128>(c.w[i] * y) * y;
+        }
+    }
+}
+
+// Один проход по кускам в пуле. Целочисленные суммы ассоциативны, поэтому
+// результат не зависит ни от числа потоков, ни от порядка сложения кусков.
+ExactMoments accumulateExactMoments(const IntegerColumns& c)
+{
+    const size_t n = c.x.size();
+    size_t chunks = (n + kParallelChunk - 1) / kParallelChunk;
+    std::vector<ExactMoments> partial(std::max<size_t>(chunks, 1));
+    parallelForChunks(n, kParallelChunk, [&](size_t chunk, size_t lo, size_t hi)
+    {
+        accumulateExactRange(c, lo, hi, partial[chunk]);
+    });
+
+    ExactMoments m = partial[0];
+    for (size_t k = 1; k < partial.size(); ++k)
+    {
+        for (int j = 0; j < 5; ++j)
+            m.Sx[j] += partial[k].Sx[j];
+        for (int j = 0; j < 3; ++j)
+            m.Sxy[j] += partial[k].Sxy[j];
+        m.Syy += partial[k].Syy;
+    }
+    return m;
+}
+
+// Точный сдвиг X на целое c: sum w*(x-c)^k через биномиальное разложение
+// уже накопленных сумм. Результат снова точный, но намного меньше по модулю,
+// так что последующее решение в long double хорошо обусловлено.
+void shiftExactMoments(const ExactMoments& m, int64_t c, int128 U[5], int128 Uy[3])
+{
+    static const int binom[5][5] = {
+        {1, 0, 0, 0, 0},
+        {1, 1, 0, 0, 0},
+        {1, 2, 1, 0, 0},
+        {1, 3, 3, 1, 0},
+        {1, 4, 6, 4, 1}
+    };
+    int128 negC[5] = {1, -c, int128(c) * c, -int128(c) * c * c, int128(c) * c * c * c};
+    for (int k = 0; k < 5; ++k)
+    {
+        U[k] = 0;
+        for (int j = 0; j <= k; ++j)
+            U[k] += binom[k][j] * negC[k - j] * m.Sx[j];
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+        Uy[k] = 0;
+        for (int j = 0; j <= k; ++j)
+            Uy[k] += binom[k][j] * negC[k - j] * m.Sxy[j];
+    }
+}
+
+// Целое, ближайшее к взвешенному среднему X
+int64_t exactMeanX(const ExactMoments& m)
+{
+    if (m.Sx[0] == 0)
+        return 0;
+    return static_cast<int64_t>(m.Sx[1] / m.Sx[0]);
+}
+
+// Линейная регрессия по точным суммам. Числитель и знаменатель наклона
+// n*Suy - Su*Sy и n*Suu - Su^2 считаются в int128 без округлений,
+// округление одно - при финальном делении.
+std::pair<float, float> computeExactLinearRegression(const ExactMoments& m)
+{
+    if (m.Sx[0] == 0)
+        return {0.f, 0.f};
+
+    int64_t shift = exactMeanX(m);
+    int128 U[5], Uy[3];
+    shiftExactMoments(m, shift, U, Uy);
+
+    int128 n = U[0];
+    int128 num = n * Uy[1] - U[1] * Uy[0];
+    int128 den = n * U[2] - U[1] * U[1];
+    long double slope = (den != 0) ? static_cast<long double>(num) / static_cast<long double>(den) : 0.0L;
+    long double interceptU = (static_cast<long double>(Uy[0]) - slope * static_cast<long double>(U[1])) /
+                             static_cast<long double>(n);
+    long double intercept = interceptU - slope * shift;
+    return {static_cast<float>(slope), static_cast<float>(intercept)};
+}
+
+// Парабола по точным суммам: Крамер в long double над сдвинутыми точными моментами
+Poly2Coeffs computeExactPolynomialRegression2(const ExactMoments& m)
+{
+    Poly2Coeffs coeffs{0.f, 0.f, 0.f};
+    if (m.Sx[0] < 3)
+        return coeffs;
+
+    int64_t shift = exactMeanX(m);
+    int128 U[5], Uy[3];
+    shiftExactMoments(m, shift, U, Uy);
+
+    long double A[3][3] = {
+        { (long double)U[0], (long double)U[1], (long double)U[2] },
+        { (long double)U[1], (long double)U[2], (long double)U[3] },
+        { (long double)U[2], (long double)U[3], (long double)U[4] }
+    };
+    long double B[3] = { (long double)Uy[0], (long double)Uy[1], (long double)Uy[2] };
+
+    auto det3 = [](long double M[3][3]) {
+        return M[0][0] * (M[1][1] * M[2][2] - M[1][2] * M[2][1]) -
+               M[0][1] * (M[1][0] * M[2][2] - M[1][2] * M[2][0]) +
+               M[0][2] * (M[1][0] * M[2][1] - M[1][1] * M[2][0]);
+    };
+    long double D = det3(A);
+    if (D == 0.0L)
+        return coeffs;
+
+    long double sol[3];
+    for (int col = 0; col < 3; ++col)
+    {
+        long double Ac[3][3];
+        std::memcpy(Ac, A, sizeof(A));
+        for (int r = 0; r < 3; ++r)
+            Ac[r][col] = B[r];
+        sol[col] = det3(Ac) / D;
+    }
+
+    // y = c0 + c1*u + c2*u^2, u = x - shift
+    long double c0 = sol[0], c1 = sol[1], c2 = sol[2];
+    long double s = shift;
+    coeffs.a = static_cast<float>(c2);
+    coeffs.b = static_cast<float>(c1 - 2.0L * c2 * s);
+    coeffs.c = static_cast<float>(c0 - c1 * s + c2 * s * s);
+    return coeffs;
+}
+
+std::pair<float, float> computeExactLinearRegression(const IntegerColumns& c)
+{
+    return computeExactLinearRegression(accumulateExactMoments(c));
+}
+
+Poly2Coeffs computeExactPolynomialRegression2(const IntegerColumns& c)
+{
+    return computeExactPolynomialRegression2(accumulateExactMoments(c));
+}
+
+// Точные суммы в виде PowerMoments (degree <= 2) для интервалов: сдвиг на целое
+// среднее делается точно в int128, в double попадают уже небольшие величины
+PowerMoments powerMomentsFromExact(const ExactMoments& m, int degree)
+{
+    PowerMoments pm;
+    pm.maxDegree = degree;
+    int64_t shift = exactMeanX(m);
+    int128 U[5], Uy[3];
+    shiftExactMoments(m, shift, U, Uy);
+    pm.center = static_cast<double>(shift);
+    long double spread = (U[0] > 0) ? std::sqrt(static_cast<long double>(U[2]) / static_cast<long double>(U[0]))
+                                    : 0.0L;
+    pm.scale = (spread > 0.0L) ? static_cast<double>(spread) : 1.0;
+    pm.St.resize(2 * degree + 1);
+    pm.Sty.resize(degree + 1);
+    long double scalePow = 1.0L;
+    for (int k = 0; k <= 2 * degree; ++k)
+    {
+        pm.St[k] = static_cast<double>(static_cast<long double>(U[k]) / scalePow);
+        if (k <= degree)
+            pm.Sty[k] = static_cast<double>(static_cast<long double>(Uy[k]) / scalePow);
+        scalePow *= pm.scale;
+    }
+    pm.Syy = static_cast<double>(m.Syy);
+    return pm;
+}
+
+// ----------------------------------------
+// Префиксные суммы моментов по x
+// ----------------------------------------
+
+// Степень локальной подгонки на выбранном отрезке не выше второй
+const int kRangeMaxDegree = 2;
+
+// Точки, отсортированные по x, и префиксные суммы их моментов:
+// строка i хранит суммы по первым i точкам (St[0..2D], Sty[0..D], Syy).
+// Моменты точек [i, j) - разность двух строк (стоимость отрезков в кусочно-линейной
+// регрессии, см. segmentLineCost).
+struct PrefixMoments
+{
+    int maxDegree = 0;
+    double center = 0.0;
+    double scale = 1.0;
+    std::vector<Point> sorted;
+    std::vector<double> prefix; // (sorted.size() + 1) строк по stride()
+
+    int stride() const { return 3 * maxDegree + 3; }
+};
+
+// row += вклад одной точки в моменты
+void appendPointMoments(double* row, const Point& p, int maxDegree, double center, double invScale)
+{
+    double t = (p.x - center) * invScale;
+    double wt = p.w;
+    for (int k = 0; k <= 2 * maxDegree; ++k)
+    {
+        row[k] += wt;
+        if (k <= maxDegree)
+            row[2 * maxDegree + 1 + k] += wt * p.y;
+        wt *= t;
+    }
+    row[3 * maxDegree + 2] += p.w * static_cast<double>(p.y) * p.y;
+}
+
+// Точки по возрастанию x. Уже отсортированный вход (общее хранилище из дерева
+// моментов, см. main) возвращается как есть, иначе сортируется копия в scratch.
+const std::vector<Point>& sortedByX(const std::vector<Point>& points, std::vector<Point>& scratch)
+{
+    auto byX = [](const Point& a, const Point& b) { return a.x < b.x; };
+    if (std::is_sorted(points.begin(), points.end(), byX))
+        return points;
+    scratch = points;
+    std::sort(scratch.begin(), scratch.end(), byX);
+    return scratch;
+}
+
+// Сортировка (если нужна) и параллельный префиксный проход в два этапа:
+// суммы блоков, затем заполнение строк внутри блоков от своего смещения
+PrefixMoments buildPrefixMoments(const std::vector<Point>& points, int maxDegree = kRangeMaxDegree)
+{
+    PrefixMoments pm;
+    pm.maxDegree = maxDegree;
+    std::vector<Point> scratch;
+    pm.sorted = sortedByX(points, scratch);
+    choosePolynomialScaling(pm.sorted, pm.center, pm.scale);
+
+    const size_t n = pm.sorted.size();
+    const size_t stride = pm.stride();
+    const double invScale = 1.0 / pm.scale;
+    pm.prefix.assign((n + 1) * stride, 0.0);
+
+    size_t blocks = (n + kReductionBlock - 1) / kReductionBlock;
+    std::vector<double> blockOffsets((blocks + 1) * stride, 0.0);
+    parallelForChunks(n, kReductionBlock, [&](size_t b, size_t lo, size_t hi)
+    {
+        double* acc = &blockOffsets[(b + 1) * stride];
+        for (size_t i = lo; i < hi; ++i)
+            appendPointMoments(acc, pm.sorted[i], maxDegree, pm.center, invScale);
+    });
+    for (size_t b = 1; b <= blocks; ++b)
+        for (size_t k = 0; k < stride; ++k)
+            blockOffsets[b * stride + k] += blockOffsets[(b - 1) * stride + k];
+
+    parallelForChunks(n, kReductionBlock, [&](size_t b, size_t lo, size_t hi)
+    {
+        std::vector<double> acc(blockOffsets.begin() + b * stride, blockOffsets.begin() + (b + 1) * stride);
+        for (size_t i = lo; i < hi; ++i)
+        {
+            appendPointMoments(acc.data(), pm.sorted[i], maxDegree, pm.center, invScale);
+            std::copy(acc.begin(), acc.end(), pm.prefix.begin() + (i + 1) * stride);
+        }
+    });
+    return pm;
+}
+
+// ----------------------------------------
+// Декартово дерево моментов: подгонка на отрезке при правках данных
+// ----------------------------------------
+
+// Префиксные массивы пришлось бы перестраивать целиком после каждой вставки
+// или удаления. Здесь точки лежат в декартовом дереве (treap) по ключу (x, y, w),
+// и каждый узел хранит моменты своего поддерева: вставка, удаление и запрос
+// моментов отрезка стоят O(log N) в среднем, без вычитания префиксов.
+struct MomentTree
+{
+    struct Node
+    {
+        Point p;
+        std::uint32_t priority = 0;
+        int left = -1;
+        int right = -1;
+        size_t count = 1;   // число точек в поддереве
+    };
+
+    int maxDegree = 0;
+    double center = 0.0;
+    double scale = 1.0;
+    std::vector<Node> nodes;
+    std::vector<double> sums;   // моменты поддерева узла: stride() чисел на узел
+    std::vector<int> freeNodes;
+    int root = -1;
+    std::mt19937 rng{12345};
+
+    int stride() const { return 3 * maxDegree + 3; }
+};
+
+// Строгий порядок ключей (x, y, w)
+bool momentKeyLess(const Point& a, const Point& b)
+{
+    if (a.x != b.x) return a.x < b.x;
+    if (a.y != b.y) return a.y < b.y;
+    return a.w < b.w;
+}
+
+// Пересчёт моментов и размера узла по детям
+void pullMomentNode(MomentTree& tree, int v)
+{
+    const int stride = tree.stride();
+    double* row = &tree.sums[v * stride];
+    std::fill(row, row + stride, 0.0);
+    appendPointMoments(row, tree.nodes[v].p, tree.maxDegree, tree.center, 1.0 / tree.scale);
+    tree.nodes[v].count = 1;
+    for (int child : {tree.nodes[v].left, tree.nodes[v].right})
+    {
+        if (child < 0)
+            continue;
+        const double* c = &tree.sums[child * stride];
+        for (int k = 0; k < stride; ++k)
+            row[k] += c[k];
+        tree.nodes[v].count += tree.nodes[child].count;
+    }
+}
+
+int newMomentNode(MomentTree& tree, const Point& p)
+{
+    int v;
+    if (!tree.freeNodes.empty())
+    {
+        v = tree.freeNodes.back();
+        tree.freeNodes.pop_back();
+        tree.nodes[v] = MomentTree::Node{};
+    }
+    else
+    {
+        v = static_cast<int>(tree.nodes.size());
+        tree.nodes.emplace_back();
+        tree.sums.resize(tree.sums.size() + tree.stride());
+    }
+    tree.nodes[v].p = p;
+    tree.nodes[v].priority = static_cast<std::uint32_t>(tree.rng());
+    pullMomentNode(tree, v);
+    return v;
+}
+
+// Разрезать дерево v на ключи < key (left) и >= key (right)
+void splitMomentTree(MomentTree& tree, int v, const Point& key, int& left, int& right)
+{
+    if (v < 0)
+    {
+        left = right = -1;
+        return;
+    }
+    if (momentKeyLess(tree.nodes[v].p, key))
+    {
+        splitMomentTree(tree, tree.nodes[v].right, key, tree.nodes[v].right, right);
+        left = v;
+    }
+    else
+    {
+        splitMomentTree(tree, tree.nodes[v].left, key, left, tree.nodes[v].left);
+        right = v;
+    }
+    pullMomentNode(tree, v);
+}
+
+// Слить деревья, где все ключи a меньше ключей b
+int mergeMomentTrees(MomentTree& tree, int a, int b)
+{
+    if (a < 0) return b;
+    if (b < 0) return a;
+    if (tree.nodes[a].priority > tree.nodes[b].priority)
+    {
+        tree.nodes[a].right = mergeMomentTrees(tree, tree.nodes[a].right, b);
+        pullMomentNode(tree, a);
+        return a;
+    }
+    tree.nodes[b].left = mergeMomentTrees(tree, a, tree.nodes[b].left);
+    pullMomentNode(tree, b);
+    return b;
+}
+
+// Построение за O(N log N) (сортировка) + O(N): декартово дерево по отсортированным
+// ключам строится стеком правой ветви, моменты - проходом снизу вверх
+MomentTree buildMomentTree(const std::vector<Point>& points, int maxDegree = kRangeMaxDegree)
+{
+    MomentTree tree;
+    tree.maxDegree = maxDegree;
+    choosePolynomialScaling(points, tree.center, tree.scale);
+
+    std::vector<Point> sorted = points;
+    std::sort(sorted.begin(), sorted.end(), momentKeyLess);
+    tree.nodes.resize(sorted.size());
+    tree.sums.assign(sorted.size() * tree.stride(), 0.0);
+
+    std::vector<int> rightSpine;
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        int v = static_cast<int>(i);
+        tree.nodes[v].p = sorted[i];
+        tree.nodes[v].priority = static_cast<std::uint32_t>(tree.rng());
+        int last = -1;
+        while (!rightSpine.empty() && tree.nodes[rightSpine.back()].priority < tree.nodes[v].priority)
+        {
+            last = rightSpine.back();
+            rightSpine.pop_back();
+        }
+        tree.nodes[v].left = last;
+        if (!rightSpine.empty())
+            tree.nodes[rightSpine.back()].right = v;
+        rightSpine.push_back(v);
+    }
+    tree.root = rightSpine.empty() ? -1 : rightSpine.front();
+
+    // Обратный порядок обхода в глубину: дети пересчитываются раньше родителя
+    std::vector<int> order, stack;
+    if (tree.root >= 0)
+        stack.push_back(tree.root);
+    while (!stack.empty())
+    {
+        int v = stack.back();
+        stack.pop_back();
+        order.push_back(v);
+        if (tree.nodes[v].left >= 0) stack.push_back(tree.nodes[v].left);
+        if (tree.nodes[v].right >= 0) stack.push_back(tree.nodes[v].right);
+    }
+    for (auto it = order.rbegin(); it != order.rend(); ++it)
+        pullMomentNode(tree, *it);
+    return tree;
+}
+
+void momentTreeInsert(MomentTree& tree, const Point& p)
+{
+    int left, right;
+    splitMomentTree(tree, tree.root, p, left, right);
+    tree.root = mergeMomentTrees(tree, mergeMomentTrees(tree, left, newMomentNode(tree, p)), right);
+}
+
+// Удаляет одну точку с точно таким ключом; false, если её нет
+bool momentTreeErase(MomentTree& tree, const Point& p)
+{
+    int* link = &tree.root;
+    std::vector<int*> path;
+    while (*link >= 0)
+    {
+        MomentTree::Node& node = tree.nodes[*link];
+        if (momentKeyLess(p, node.p))
+        {
+            path.push_back(link);
+            link = &node.left;
+        }
+        else if (momentKeyLess(node.p, p))
+        {
+            path.push_back(link);
+            link = &node.right;
+        }
+        else
+        {
+            int v = *link;
+            *link = mergeMomentTrees(tree, node.left, node.right);
+            tree.freeNodes.push_back(v);
+            for (auto it = path.rbegin(); it != path.rend(); ++it)
+                pullMomentNode(tree, **it);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Суммы моментов (и число точек) по ключам с x в [x0, x1]: O(log N) узлов
+void momentTreeRangeSums(const MomentTree& tree, float x0, float x1, std::vector<double>& acc, size_t& count)
+{
+    const int stride = tree.stride();
+    acc.assign(stride, 0.0);
+    count = 0;
+    auto addNode = [&](int v)
+    {
+        appendPointMoments(acc.data(), tree.nodes[v].p, tree.maxDegree, tree.center, 1.0 / tree.scale);
+        ++count;
+    };
+    auto addSubtree = [&](int v)
+    {
+        if (v < 0)
+            return;
+        for (int k = 0; k < stride; ++k)
+            acc[k] += tree.sums[v * stride + k];
+        count += tree.nodes[v].count;
+    };
+
+    // Спуск до узла, где отрезок расходится на две ветви
+    int v = tree.root;
+    while (v >= 0 && (tree.nodes[v].p.x < x0 || tree.nodes[v].p.x > x1))
+        v = (tree.nodes[v].p.x < x0) ? tree.nodes[v].right : tree.nodes[v].left;
+    if (v < 0)
+        return;
+    addNode(v);
+
+    // Левая ветвь: всё с x >= x0
+    for (int u = tree.nodes[v].left; u >= 0;)
+    {
+        if (tree.nodes[u].p.x >= x0)
+        {
+            addNode(u);
+            addSubtree(tree.nodes[u].right);
+            u = tree.nodes[u].left;
+        }
+        else
+            u = tree.nodes[u].right;
+    }
+    // Правая ветвь: всё с x <= x1
+    for (int u = tree.nodes[v].right; u >= 0;)
+    {
+        if (tree.nodes[u].p.x <= x1)
+        {
+            addNode(u);
+            addSubtree(tree.nodes[u].left);
+            u = tree.nodes[u].right;
+        }
+        else
+            u = tree.nodes[u].left;
+    }
+}
+
+// Точки с x в [x0, x1] по порядку (для небольших отрезков)
+void momentTreeCollect(const MomentTree& tree, int v, float x0, float x1, std::vector<Point>& out)
+{
+    if (v < 0)
+        return;
+    const MomentTree::Node& node = tree.nodes[v];
+    if (node.p.x >= x0)
+        momentTreeCollect(tree, node.left, x0, x1, out);
+    if (node.p.x >= x0 && node.p.x <= x1)
+        out.push_back(node.p);
+    if (node.p.x <= x1)
+        momentTreeCollect(tree, node.right, x0, x1, out);
+}
+
+// Подгонка полинома по точкам с x в [x0, x1]: O(log N + degree^3).
+// Как и у префиксных массивов, небольшие отрезки считаются напрямую в своём масштабе.
+bool fitRangeFromTree(const MomentTree& tree, float x0, float x1, int degree, PolyModel& model,
+                      double* count = nullptr)
+{
+    if (x0 > x1)
+        std::swap(x0, x1);
+    if (degree > tree.maxDegree)
+        return false;
+
+    std::vector<double> acc;
+    size_t n = 0;
+    momentTreeRangeSums(tree, x0, x1, acc, n);
+    if (n == 0)
+        return false;
+
+    const int D = tree.maxDegree;
+    if (count)
+        *count = acc[0];
+
+    PowerMoments m;
+    if (n <= kReductionBlock)
+    {
+        std::vector<Point> inRange;
+        inRange.reserve(n);
+        momentTreeCollect(tree, tree.root, x0, x1, inRange);
+        double center = 0.5 * (inRange.front().x + inRange.back().x);
+        double scale = std::max(0.5 * (inRange.back().x - inRange.front().x), 1e-12);
+        m = accumulatePowerMoments(inRange.data(), inRange.size(), degree, center, scale);
+    }
+    else
+    {
+        m.maxDegree = D;
+        m.center = tree.center;
+        m.scale = tree.scale;
+        m.St.assign(acc.begin(), acc.begin() + 2 * D + 1);
+        m.Sty.assign(acc.begin() + 2 * D + 1, acc.begin() + 3 * D + 2);
+        m.Syy = acc[3 * D + 2];
+    }
+    return solvePolynomialFromMoments(m, degree, model);
+}
+
+// ----------------------------------------
+// Кусочно-линейная (сегментированная) регрессия
+// ----------------------------------------
+
+const int kMaxSegments = 6;
+const int kMinSegmentPoints = 5;
+const int kSegmentCandidates = 1000; // число возможных границ в грубом поиске
+
+// Сегменты по возрастанию x: breaks[i] - граница между pieces[i] и pieces[i+1]
+struct SegmentedModel
+{
+    std::vector<double> breaks;
+    std::vector<PolyModel> pieces;
+};
+
+int segmentIndex(const SegmentedModel& model, float x)
+{
+    return static_cast<int>(std::upper_bound(model.breaks.begin(), model.breaks.end(), x) - model.breaks.begin());
+}
+
+float evaluateSegmented(const SegmentedModel& model, float x)
+{
+    if (model.pieces.empty())
+        return 0.f;
+    return evaluatePolyModel(model.pieces[segmentIndex(model, x)], x);
+}
+
+// RSS прямой на отсортированных точках [i, j) за O(1) по разности префиксов
+double segmentLineCost(const PrefixMoments& pm, size_t i, size_t j)
+{
+    const int stride = pm.stride();
+    const double* a = &pm.prefix[i * stride];
+    const double* b = &pm.prefix[j * stride];
+    double n = b[0] - a[0];
+    if (n <= 0.0)
+        return 0.0;
+    double st = b[1] - a[1], stt = b[2] - a[2];
+    double sy = b[3] - a[3], sty = b[4] - a[4], syy = b[5] - a[5];
+    double sxx = stt - st * st / n;
+    double sxy = sty - st * sy / n;
+    double rss = syy - sy * sy / n;
+    if (sxx > 1e-12 * stt)
+        rss -= sxy * sxy / sxx;
+    return std::max(rss, 0.0);
+}
+
+// Разбиение на 1..kMaxSegments прямых: динамическое программирование по
+// ~1000 равномерно расставленным кандидатам в границы (O(k*M^2) при стоимости
+// сегмента O(1) из префиксных моментов), выбор числа сегментов по BIC и
+// уточнение каждой границы точным перебором между соседними кандидатами.
+SegmentedModel computeSegmentedRegression(const std::vector<Point>& points, int maxSegments = kMaxSegments)
+{
+    SegmentedModel model;
+    if (points.empty())
+        return model;
+
+    // y сдвигается на среднее, чтобы разности префиксов не теряли точность
+    double meanY = 0.0, totalW = 0.0;
+    for (auto& p : points)
+    {
+        meanY += p.w * p.y;
+        totalW += p.w;
+    }
+    meanY /= totalW;
+    std::vector<Point> shifted = points;
+    for (auto& p : shifted)
+        p.y = static_cast<float>(p.y - meanY);
+    PrefixMoments pm = buildPrefixMoments(shifted, 1);
+    const std::vector<Point>& sorted = pm.sorted;
+    const size_t n = sorted.size();
+
+    // Кандидаты в границы: равномерно по индексу, сдвинутые так,
+    // чтобы не разрывать одинаковые x
+    std::vector<size_t> cand{0};
+    size_t M = std::min<size_t>(n, kSegmentCandidates);
+    for (size_t c = 1; c < M; ++c)
+    {
+        size_t i = c * n / M;
+        while (i < n && sorted[i - 1].x == sorted[i].x)
+            ++i;
+        if (i < n && i > cand.back())
+            cand.push_back(i);
+    }
+    cand.push_back(n);
+    M = cand.size() - 1;
+
+    // cost[k][m] - лучшая RSS первых cand[m] точек k сегментами
+    const double inf = std::numeric_limits<double>::infinity();
+    int K = std::max(1, std::min<int>(maxSegments, static_cast<int>(n / kMinSegmentPoints)));
+    std::vector<std::vector<double>> cost(K + 1, std::vector<double>(M + 1, inf));
+    std::vector<std::vector<int>> from(K + 1, std::vector<int>(M + 1, -1));
+    for (size_t m = 1; m <= M; ++m)
+        if (cand[m] >= kMinSegmentPoints)
+            cost[1][m] = segmentLineCost(pm, 0, cand[m]);
+    for (int k = 2; k <= K; ++k)
+    {
+        parallelForChunks(M, 64, [&](size_t, size_t lo, size_t hi)
+        {
+            for (size_t m = lo + 1; m <= hi; ++m)
+            {
+                for (size_t j = 1; j < m; ++j)
+                {
+                    if (cost[k - 1][j] == inf || cand[m] - cand[j] < kMinSegmentPoints)
+                        continue;
+                    double c = cost[k - 1][j] + segmentLineCost(pm, cand[j], cand[m]);
+                    if (c < cost[k][m])
+                    {
+                        cost[k][m] = c;
+                        from[k][m] = static_cast<int>(j);
+                    }
+                }
+            }
+        });
+    }
+
+    // BIC: 2 параметра на прямую и по одному на границу
+    int bestK = 1;
+    double bestBic = inf;
+    for (int k = 1; k <= K; ++k)
+    {
+        if (cost[k][M] == inf)
+            continue;
+        double rss = std::max(cost[k][M], 1e-300);
+        double bic = totalW * std::log(rss / totalW) + (3.0 * k - 1.0) * std::log(totalW);
+        if (bic < bestBic)
+        {
+            bestBic = bic;
+            bestK = k;
+        }
+    }
+
+    // Границы в индексах кандидатов -> в индексах точек
+    std::vector<int> candBounds(bestK + 1);
+    candBounds[bestK] = static_cast<int>(M);
+    for (int k = bestK; k >= 2; --k)
+        candBounds[k - 1] = from[k][candBounds[k]];
+    candBounds[0] = 0;
+    std::vector<size_t> bounds(bestK + 1);
+    for (int k = 0; k <= bestK; ++k)
+        bounds[k] = cand[candBounds[k]];
+
+    // Уточнение: каждая граница ищется точно между соседними кандидатами
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int k = 1; k < bestK; ++k)
+        {
+            size_t lo = std::max(bounds[k - 1] + kMinSegmentPoints, cand[std::max(candBounds[k] - 1, 0)]);
+            size_t hi = std::min(bounds[k + 1] - kMinSegmentPoints, cand[std::min<size_t>(candBounds[k] + 1, M)]);
+            double best = segmentLineCost(pm, bounds[k - 1], bounds[k]) + segmentLineCost(pm, bounds[k], bounds[k + 1]);
+            for (size_t b = lo; b <= hi; ++b)
+            {
+                if (b == 0 || b >= n || sorted[b - 1].x == sorted[b].x)
+                    continue;
+                double c = segmentLineCost(pm, bounds[k - 1], b) + segmentLineCost(pm, b, bounds[k + 1]);
+                if (c < best)
+                {
+                    best = c;
+                    bounds[k] = b;
+                }
+            }
+        }
+    }
+
+    // Прямые по сегментам - в своём масштабе, с возвратом сдвига по y
+    for (int k = 0; k < bestK; ++k)
+    {
+        const Point* first = sorted.data() + bounds[k];
+        size_t count = bounds[k + 1] - bounds[k];
+        double center = 0.5 * (first[0].x + first[count - 1].x);
+        double scale = std::max(0.5 * (first[count - 1].x - first[0].x), 1e-12);
+        PowerMoments m = accumulatePowerMoments(first, count, 1, center, scale);
+        PolyModel piece;
+        if (!solvePolynomialFromMoments(m, 1, piece) && !solvePolynomialFromMoments(m, 0, piece))
+            piece = PolyModel{0, center, scale, {0.0}};
+        piece.coeffs[0] += meanY;
+        model.pieces.push_back(piece);
+        if (k > 0)
+            model.breaks.push_back(0.5 * (first[-1].x + first[0].x));
+    }
+    return model;
+}
+
+// ----------------------------------------
+// Кубический сглаживающий сплайн (алгоритм Reinsch)
+// ----------------------------------------
+
+// Натуральный кубический сплайн: значения values и вторые производные
+// secondDeriv в узлах knots (на концах вторая производная равна нулю)
+struct SmoothingSpline
+{
+    std::vector<double> knots;
+    std::vector<double> values;
+    std::vector<double> secondDeriv;
+    double lambda = 0.0;
+    double edf = 0.0;       // эффективное число параметров, tr(A)
+    double gcv = 0.0;
+};
+
+// Узлы сплайна и всё, что не зависит от lambda: шаги h, 1/h и Q^T y.
+// Точки с одинаковым x сливаются в одну с суммарным весом и взвешенным
+// средним y (решение от этого не меняется).
+struct SplineKnots
+{
+    std::vector<double> x, y, w;
+    std::vector<double> h, invH;   // n-1 шагов
+    std::vector<double> qty;       // Q^T y, n-2 значений
+};
+
+SplineKnots makeSplineKnots(const std::vector<Point>& points)
+{
+    SplineKnots k;
+    std::vector<Point> scratch;
+    const std::vector<Point>& sorted = sortedByX(points, scratch);
+    for (auto& p : sorted)
+    {
+        if (!k.x.empty() && k.x.back() == p.x)
+        {
+            k.y.back() += p.w * p.y;
+            k.w.back() += p.w;
+        }
+        else
+        {
+            k.x.push_back(p.x);
+            k.y.push_back(p.w * p.y);
+            k.w.push_back(p.w);
+        }
+    }
+    const size_t n = k.x.size();
+    for (size_t i = 0; i < n; ++i)
+        k.y[i] /= k.w[i];
+    if (n < 3)
+        return k;
+
+    k.h.resize(n - 1);
+    k.invH.resize(n - 1);
+    for (size_t i = 0; i + 1 < n; ++i)
+    {
+        k.h[i] = k.x[i + 1] - k.x[i];
+        k.invH[i] = 1.0 / k.h[i];
+    }
+    // Столбец j матрицы Q (внутренний узел j+1) затрагивает узлы j, j+1, j+2
+    k.qty.resize(n - 2);
+    for (size_t j = 0; j + 2 < n; ++j)
+        k.qty[j] = (k.y[j + 2] - k.y[j + 1]) * k.invH[j + 1] - (k.y[j + 1] - k.y[j]) * k.invH[j];
+    return k;
+}
+
+// Пятидиагональная симметричная матрица B = R + lambda * Q^T W^-1 Q
+// порядка m = n-2 в виде разложения B = L D L^T (у L две поддиагонали)
+struct SplineSystem
+{
+    int m = 0;
+    std::vector<double> d, l1, l2;
+};
+
+// Сборка и разложение за O(n); false, если матрица не положительно определена
+bool factorSplineSystem(const SplineKnots& k, double lambda, SplineSystem& sys)
+{
+    const int m = static_cast<int>(k.x.size()) - 2;
+    sys.m = m;
+    sys.d.resize(m);
+    sys.l1.assign(m, 0.0);
+    sys.l2.assign(m, 0.0);
+
+    for (int j = 0; j < m; ++j)
+    {
+        // Элементы столбца j матрицы Q: строки j, j+1, j+2
+        double q0 = k.invH[j], q1 = -k.invH[j] - k.invH[j + 1], q2 = k.invH[j + 1];
+        double b0 = (k.h[j] + k.h[j + 1]) / 3.0 +
+                    lambda * (q0 * q0 / k.w[j] + q1 * q1 / k.w[j + 1] + q2 * q2 / k.w[j + 2]);
+        double b1 = 0.0, b2 = 0.0;
+        if (j + 1 < m)
+            b1 = k.h[j + 1] / 6.0 +
+                 lambda * (q1 * k.invH[j + 1] / k.w[j + 1] + q2 * (-k.invH[j + 1] - k.invH[j + 2]) / k.w[j + 2]);
+        if (j + 2 < m)
+            b2 = lambda * q2 * k.invH[j + 2] / k.w[j + 2];
+
+        // Шаг LDL^T ленточной матрицы
+        double dj = b0;
+        if (j >= 1) dj -= sys.l1[j - 1] * sys.l1[j - 1] * sys.d[j - 1];
+        if (j >= 2) dj -= sys.l2[j - 2] * sys.l2[j - 2] * sys.d[j - 2];
+        if (!(dj > 0.0))
+            return false;
+        sys.d[j] = dj;
+        if (j + 1 < m)
+        {
+            if (j >= 1) b1 -= sys.l1[j - 1] * sys.l2[j - 1] * sys.d[j - 1];
+            sys.l1[j] = b1 / dj;
+        }
+        if (j + 2 < m)
+            sys.l2[j] = b2 / dj;
+    }
+    return true;
+}
+
+void solveSplineSystem(const SplineSystem& sys, std::vector<double>& b)
+{
+    const int m = sys.m;
+    for (int j = 0; j < m; ++j)
+    {
+        if (j >= 1) b[j] -= sys.l1[j - 1] * b[j - 1];
+        if (j >= 2) b[j] -= sys.l2[j - 2] * b[j - 2];
+    }
+    for (int j = 0; j < m; ++j)
+        b[j] /= sys.d[j];
+    for (int j = m - 1; j >= 0; --j)
+    {
+        if (j + 1 < m) b[j] -= sys.l1[j] * b[j + 1];
+        if (j + 2 < m) b[j] -= sys.l2[j] * b[j + 2];
+    }
+}
+
+// Подгонка при заданном lambda; заодно tr(A) и GCV по тому же разложению:
+// элементы B^-1 внутри ленты считаются обратной рекурсией (Hutchinson, de Hoog) за O(n)
+bool fitSplineForLambda(const SplineKnots& k, double lambda, SmoothingSpline& spline)
+{
+    const size_t n = k.x.size();
+    SplineSystem sys;
+    if (!factorSplineSystem(k, lambda, sys))
+        return false;
+    const int m = sys.m;
+
+    std::vector<double> gamma = k.qty;
+    solveSplineSystem(sys, gamma);
+
+    // Строка i матрицы Q: ненулевые столбцы i-2, i-1, i
+    auto qRow = [&](size_t i, double* q, int* cols) -> int
+    {
+        int c = 0;
+        if (i >= 2)                         { cols[c] = int(i) - 2; q[c++] = k.invH[i - 1]; }
+        if (i >= 1 && i - 1 < size_t(m))    { cols[c] = int(i) - 1; q[c++] = -k.invH[i - 1] - k.invH[i]; }
+        if (i < size_t(m))                  { cols[c] = int(i); q[c++] = k.invH[i]; }
+        return c;
+    };
+
+    // g = y - lambda * W^-1 Q gamma
+    spline.knots = k.x;
+    spline.values.resize(n);
+    spline.secondDeriv.assign(n, 0.0);
+    std::copy(gamma.begin(), gamma.end(), spline.secondDeriv.begin() + 1);
+    double rss = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        double q[3];
+        int cols[3];
+        int c = qRow(i, q, cols);
+        double qg = 0.0;
+        for (int a = 0; a < c; ++a)
+            qg += q[a] * gamma[cols[a]];
+        double r = lambda * qg / k.w[i];
+        spline.values[i] = k.y[i] - r;
+        rss += k.w[i] * r * r;
+    }
+
+    // S = B^-1 внутри ленты: band[3j] = S[j][j], band[3j+1] = S[j][j+1], band[3j+2] = S[j][j+2]
+    std::vector<double> band(3 * m + 6, 0.0);
+    for (int j = m - 1; j >= 0; --j)
+    {
+        double a = sys.l1[j], b = sys.l2[j]; // за пределами ленты они нулевые
+        band[3 * j + 2] = -a * band[3 * (j + 1) + 1] - b * band[3 * (j + 2)];
+        band[3 * j + 1] = -a * band[3 * (j + 1)] - b * band[3 * (j + 1) + 1];
+        band[3 * j] = 1.0 / sys.d[j] - a * band[3 * j + 1] - b * band[3 * j + 2];
+    }
+
+    // tr(I - A) = lambda * sum_i (Q S Q^T)_ii / w_i
+    double trResidual = 0.0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        double q[3];
+        int cols[3];
+        int c = qRow(i, q, cols);
+        double v = 0.0;
+        for (int a = 0; a < c; ++a)
+        {
+            v += q[a] * q[a] * band[3 * cols[a]];
+            for (int b = a + 1; b < c; ++b)
+                v += 2.0 * q[a] * q[b] * band[3 * cols[a] + (cols[b] - cols[a])];
+        }
+        trResidual += lambda * v / k.w[i];
+    }
+
+    spline.lambda = lambda;
+    spline.edf = static_cast<double>(n) - trResidual;
+    spline.gcv = (trResidual > 1e-12) ? static_cast<double>(n) * rss / (trResidual * trResidual)
+                                      : std::numeric_limits<double>::infinity();
+    return true;
+}
+
+// Сплайн с lambda по минимуму GCV: сетка по log(lambda), затем золотое сечение
+// вокруг лучшего узла сетки; каждая оценка - одно O(n) разложение.
+// Масштаб lambda - W * L^3 (сумма весов на куб размаха x): при lambda >> W * L^3
+// сплайн почти прямая, поэтому сетка идёт от него вниз на 14 порядков.
+SmoothingSpline computeSmoothingSpline(const std::vector<Point>& points)
+{
+    SmoothingSpline best;
+    SplineKnots k = makeSplineKnots(points);
+    const size_t n = k.x.size();
+    if (n < 3)
+    {
+        // Меньше трёх различных x: ломаная через узлы
+        best.knots = k.x;
+        best.values = k.y;
+        best.secondDeriv.assign(n, 0.0);
+        best.edf = static_cast<double>(n);
+        return best;
+    }
+
+    double weightSum = 0.0;
+    for (double w : k.w)
+        weightSum += w;
+    double range = k.x.back() - k.x.front();
+    double lambdaScale = weightSum * range * range * range;
+
+    double bestGcv = std::numeric_limits<double>::infinity();
+    auto gcvAt = [&](double logLambda)
+    {
+        SmoothingSpline s;
+        if (!fitSplineForLambda(k, lambdaScale * std::pow(10.0, logLambda), s))
+            return std::numeric_limits<double>::infinity();
+        double v = s.gcv;
+        if (v < bestGcv)
+        {
+            bestGcv = v;
+            best = std::move(s);
+        }
+        return v;
+    };
+
+    const int gridSize = 15;
+    const double lo = -14.0, hi = 0.0;
+    double bestLog = lo, gridBest = std::numeric_limits<double>::infinity();
+    for (int g = 0; g < gridSize; ++g)
+    {
+        double logLambda = lo + (hi - lo) * g / (gridSize - 1);
+        double v = gcvAt(logLambda);
+        if (v < gridBest)
+        {
+            gridBest = v;
+            bestLog = logLambda;
+        }
+    }
+
+    double step = (hi - lo) / (gridSize - 1);
+    double a = bestLog - step, b = bestLog + step;
+    const double phi = 0.5 * (std::sqrt(5.0) - 1.0);
+    double c = b - phi * (b - a), d = a + phi * (b - a);
+    double vc = gcvAt(c), vd = gcvAt(d);
+    for (int it = 0; it < 12; ++it)
+    {
+        if (vc < vd)
+        {
+            b = d; d = c; vd = vc;
+            c = b - phi * (b - a);
+            vc = gcvAt(c);
+        }
+        else
+        {
+            a = c; c = d; vc = vd;
+            d = a + phi * (b - a);
+            vd = gcvAt(d);
+        }
+    }
+    return best;
+}
+
+// Значение на отрезке [knots[i], knots[i+1]] по значениям и вторым производным
+double evaluateSplineSegment(const SmoothingSpline& s, size_t i, double x)
+{
+    double h = s.knots[i + 1] - s.knots[i];
+    double a = x - s.knots[i], b = s.knots[i + 1] - x;
+    return (a * s.values[i + 1] + b * s.values[i]) / h -
+           a * b / 6.0 * ((1.0 + a / h) * s.secondDeriv[i + 1] + (1.0 + b / h) * s.secondDeriv[i]);
+}
+
+// Вне узлов сплайн продолжается прямой (натуральный сплайн)
+float evaluateSmoothingSpline(const SmoothingSpline& s, float x)
+{
+    const size_t n = s.knots.size();
+    if (n == 0)
+        return 0.f;
+    if (n == 1)
+        return static_cast<float>(s.values[0]);
+    if (x <= s.knots.front())
+    {
+        double h = s.knots[1] - s.knots[0];
+        double slope = (s.values[1] - s.values[0]) / h - h * s.secondDeriv[1] / 6.0;
+        return static_cast<float>(s.values[0] + slope * (x - s.knots[0]));
+    }
+    if (x >= s.knots.back())
+    {
+        double h = s.knots[n - 1] - s.knots[n - 2];
+        double slope = (s.values[n - 1] - s.values[n - 2]) / h + h * s.secondDeriv[n - 2] / 6.0;
+        return static_cast<float>(s.values[n - 1] + slope * (x - s.knots[n - 1]));
+    }
+    size_t i = std::upper_bound(s.knots.begin(), s.knots.end(), static_cast<double>(x)) - s.knots.begin() - 1;
+    return static_cast<float>(evaluateSplineSegment(s, i, x));
+}
+
+// Пакетное вычисление: запросы режутся на куски по потокам; внутри куска
+// отрезок ищется бинарным поиском только для первого запроса, дальше для
+// возрастающих x указатель просто сдвигается вперёд
+void evaluateSmoothingSplineBatch(const SmoothingSpline& s, const float* xs, float* out, size_t count)
+{
+    const size_t n = s.knots.size();
+    parallelForChunks(count, 4096, [&](size_t, size_t lo, size_t hi)
+    {
+        size_t seg = 0;
+        for (size_t q = lo; q < hi; ++q)
+        {
+            double x = xs[q];
+            if (n < 2 || x <= s.knots.front() || x >= s.knots.back())
+            {
+                out[q] = evaluateSmoothingSpline(s, xs[q]);
+                continue;
+            }
+            if (q == lo || x < s.knots[seg])
+                seg = std::upper_bound(s.knots.begin(), s.knots.end(), x) - s.knots.begin() - 1;
+            while (x >= s.knots[seg + 1])
+                ++seg;
+            out[q] = static_cast<float>(evaluateSplineSegment(s, seg, x));
+        }
+    });
+}
+
+// ----------------------------------------
+// LOESS: локальная линейная регрессия
+// ----------------------------------------
+
+// Число узлов сетки, в которых LOESS считается точно; между узлами -
+// линейная интерполяция (так же поступает и классический loess)
+const int kLoessGrid = 128;
+
+struct LoessModel
+{
+    double span = 0.3;
+    std::vector<double> gridX;
+    std::vector<double> gridY;
+};
+
+// Линейная интерполяция по сетке; за краями продолжается крайний отрезок
+float evaluateLoess(const LoessModel& model, float x)
+{
+    const size_t g = model.gridX.size();
+    if (g == 0)
+        return 0.f;
+    if (g == 1)
+        return static_cast<float>(model.gridY[0]);
+    size_t i = std::upper_bound(model.gridX.begin(), model.gridX.end(), static_cast<double>(x)) - model.gridX.begin();
+    i = std::min(std::max<size_t>(i, 1), g - 1);
+    double t = (x - model.gridX[i - 1]) / (model.gridX[i] - model.gridX[i - 1]);
+    return static_cast<float>(model.gridY[i - 1] + t * (model.gridY[i] - model.gridY[i - 1]));
+}
+
+// LOESS со степенью 1 и весами tricube по доле span ближайших соседей.
+// Точки сортируются по x один раз; k ближайших к узлу сетки - непрерывное окно
+// в отсортированном массиве, и при переходе к следующему узлу оно только
+// сдвигается вправо (два указателя), без полного просмотра. Узлы сетки
+// считаются параллельно, каждый поток ведёт своё окно по своему куску сетки.
+// Веса tricube зависят от центра окна, поэтому сдвинуть можно только границы
+// окна, а сами взвешенные суммы считаются заново по окну для каждого узла.
+// robustIterations > 0 - итерации LOWESS с биквадратными весами по остаткам.
+LoessModel computeLoess(const std::vector<Point>& points, double span = 0.3, int robustIterations = 1)
+{
+    LoessModel model;
+    model.span = span;
+    if (points.empty())
+        return model;
+
+    std::vector<Point> scratch;
+    const std::vector<Point>& sorted = sortedByX(points, scratch);
+    const size_t n = sorted.size();
+    const size_t k = std::min(n, std::max<size_t>(3, static_cast<size_t>(std::ceil(span * n))));
+
+    const double lo = sorted.front().x, hi = sorted.back().x;
+    const size_t grid = (hi > lo) ? std::min<size_t>(kLoessGrid, n) : 1;
+    model.gridX.resize(grid);
+    model.gridY.assign(grid, 0.0);
+    for (size_t g = 0; g < grid; ++g)
+        model.gridX[g] = (grid > 1) ? lo + (hi - lo) * g / (grid - 1) : lo;
+
+    std::vector<double> robustness(n, 1.0);
+    for (int iter = 0; iter <= robustIterations; ++iter)
+    {
+        parallelForChunks(grid, 8, [&](size_t, size_t first, size_t last)
+        {
+            // Начальное окно куска - вокруг первого узла бинарным поиском
+            double x0 = model.gridX[first];
+            size_t mid = std::lower_bound(sorted.begin(), sorted.end(), x0,
+                                          [](const Point& p, double x) { return p.x < x; }) - sorted.begin();
+            size_t left = (mid > k / 2) ? std::min(mid - k / 2, n - k) : 0;
+
+            for (size_t g = first; g < last; ++g)
+            {
+                double gx = model.gridX[g];
+                while (left > 0 && gx - sorted[left - 1].x < sorted[left + k - 1].x - gx)
+                    --left;
+                while (left + k < n && sorted[left + k].x - gx < gx - sorted[left].x)
+                    ++left;
+
+                double radius = std::max(gx - sorted[left].x, sorted[left + k - 1].x - gx);
+                if (span > 1.0)
+                    radius *= span;
+                radius = radius * 1.0001 + 1e-12;
+
+                // Взвешенная прямая в t = (x - gx) / radius; значение в узле - свободный член
+                double s0 = 0.0, s1 = 0.0, s2 = 0.0, sy = 0.0, sty = 0.0;
+                for (size_t i = left; i < left + k; ++i)
+                {
+                    double t = (sorted[i].x - gx) / radius;
+                    double u = 1.0 - std::fabs(t * t * t);
+                    double w = u * u * u * sorted[i].w * robustness[i];
+                    s0 += w;
+                    s1 += w * t;
+                    s2 += w * t * t;
+                    sy += w * sorted[i].y;
+                    sty += w * t * sorted[i].y;
+                }
+                double det = s0 * s2 - s1 * s1;
+                if (det > 1e-12 * s0 * s0)
+                    model.gridY[g] = (s2 * sy - s1 * sty) / det;
+                else
+                    model.gridY[g] = (s0 > 0.0) ? sy / s0 : 0.0;
+            }
+        });
+
+        if (iter == robustIterations)
+            break;
+
+        // Биквадратные веса по остаткам относительно 6 медиан |r|
+        std::vector<double> absRes(n);
+        for (size_t i = 0; i < n; ++i)
+            absRes[i] = std::fabs(sorted[i].y - evaluateLoess(model, sorted[i].x));
+        std::vector<double> tmp = absRes;
+        std::nth_element(tmp.begin(), tmp.begin() + n / 2, tmp.end());
+        double cutoff = 6.0 * tmp[n / 2];
+        if (cutoff <= 0.0)
+            break;
+        for (size_t i = 0; i < n; ++i)
+        {
+            double u = absRes[i] / cutoff;
+            robustness[i] = (u < 1.0) ? (1.0 - u * u) * (1.0 - u * u) : 0.0;
+        }
+    }
+    return model;
+}
+
+// ----------------------------------------
+// Нелинейные модели через линеаризующие преобразования
+// ----------------------------------------
+
+// После преобразования (u, v) = (x или ln x, y или ln y) модель становится
+// прямой v = B * u + A и считается тем же проходом моментов, что и линейная
+struct TransformModel
+{
+    RegressionType kind = RegressionType::EXPONENTIAL;
+    double a = 0.0;
+    double b = 0.0;
+    bool valid = false;
+    bool refined = false;   // уточнена Гаусса-Ньютоном в исходных координатах
+    size_t used = 0;        // сколько точек попало в линеаризованную подгонку
+};
+
+// Буферы переиспользуются между подгонками: clear() не освобождает память
+struct TransformWorkspace
+{
+    std::vector<Point> original;      // точки с допустимым x (для уточнения)
+    std::vector<Point> transformed;   // (u, v, w) точек с допустимыми x и y
+};
+
+float evaluateTransformModel(const TransformModel& m, float x)
+{
+    if (!m.valid)
+        return 0.f;
+    switch (m.kind)
+    {
+    case RegressionType::EXPONENTIAL:
+        return static_cast<float>(m.a * std::exp(m.b * x));
+    case RegressionType::POWER_LAW:
+        return (x > 0.f) ? static_cast<float>(m.a * std::pow(static_cast<double>(x), m.b))
+                         : std::numeric_limits<float>::quiet_NaN();
+    default: // LOGARITHMIC
+        return (x > 0.f) ? static_cast<float>(m.a + m.b * std::log(static_cast<double>(x)))
+                         : std::numeric_limits<float>::quiet_NaN();
+    }
+}
+
+// Преобразование в буферы: логарифм x нужен степенной и логарифмической
+// моделям, логарифм y - экспоненциальной и степенной
+void fillTransformWorkspace(const std::vector<Point>& points, RegressionType kind, TransformWorkspace& ws)
+{
+    const bool logX = (kind == RegressionType::POWER_LAW || kind == RegressionType::LOGARITHMIC);
+    const bool logY = (kind == RegressionType::EXPONENTIAL || kind == RegressionType::POWER_LAW);
+    ws.original.clear();
+    ws.transformed.clear();
+    for (const Point& p : points)
+    {
+        if (logX && !(p.x > 0.f))
+            continue;
+        ws.original.push_back(p);
+        if (logY && !(p.y > 0.f))
+            continue;
+        ws.transformed.push_back({logX ? std::log(p.x) : p.x, logY ? std::log(p.y) : p.y, p.w});
+    }
+}
+
+// Уточнение Гаусса-Ньютона для a*exp(b*x) и a*x^b в исходных координатах:
+// J^T J (2x2) и J^T r копятся детерминированной редукцией прямо по буферу,
+// без временных массивов; шаг дробится, пока сумма квадратов не уменьшится
+void refineTransformModel(const TransformWorkspace& ws, TransformModel& m, int maxIterations = 50)
+{
+    if (m.kind == RegressionType::LOGARITHMIC || ws.original.size() < 2)
+        return; // линейна по a, b: линеаризованное решение уже точное
+
+    const bool expModel = (m.kind == RegressionType::EXPONENTIAL);
+    struct GNSums { double jaa = 0.0, jab = 0.0, jbb = 0.0, ra = 0.0, rb = 0.0, sse = 0.0; };
+    auto sums = [&](double a, double b)
+    {
+        return deterministicReduce(ws.original.size(), GNSums{}, [&](size_t lo, size_t hi)
+        {
+            GNSums s;
+            for (size_t i = lo; i < hi; ++i)
+            {
+                const Point& p = ws.original[i];
+                double basis = expModel ? std::exp(b * p.x) : std::pow(static_cast<double>(p.x), b);
+                double ja = basis;
+                double jb = a * basis * (expModel ? p.x : std::log(static_cast<double>(p.x)));
+                double r = p.y - a * basis;
+                s.jaa += p.w * ja * ja;
+                s.jab += p.w * ja * jb;
+                s.jbb += p.w * jb * jb;
+                s.ra += p.w * ja * r;
+                s.rb += p.w * jb * r;
+                s.sse += p.w * r * r;
+            }
+            return s;
+        }, [](GNSums& acc, const GNSums& part)
+        {
+            acc.jaa += part.jaa; acc.jab += part.jab; acc.jbb += part.jbb;
+            acc.ra += part.ra; acc.rb += part.rb; acc.sse += part.sse;
+        });
+    };
+
+    GNSums cur = sums(m.a, m.b);
+    for (int it = 0; it < maxIterations && std::isfinite(cur.sse); ++it)
+    {
+        double det = cur.jaa * cur.jbb - cur.jab * cur.jab;
+        if (!(std::fabs(det) > 1e-300))
+            break;
+        double da = (cur.jbb * cur.ra - cur.jab * cur.rb) / det;
+        double db = (cur.jaa * cur.rb - cur.jab * cur.ra) / det;
+
+        bool improved = false;
+        for (double step = 1.0; step > 1e-6; step *= 0.5)
+        {
+            GNSums next = sums(m.a + step * da, m.b + step * db);
+            if (std::isfinite(next.sse) && next.sse < cur.sse)
+            {
+                m.a += step * da;
+                m.b += step * db;
+                improved = (cur.sse - next.sse) > 1e-12 * cur.sse;
+                cur = next;
+                break;
+            }
+        }
+        if (!improved)
+            break;
+    }
+    m.refined = true;
+}
+
+// Подгонка через преобразование; refine - уточнить в исходных координатах
+TransformModel computeTransformRegression(const std::vector<Point>& points, RegressionType kind,
+                                          TransformWorkspace& ws, bool refine)
+{
+    TransformModel m;
+    m.kind = kind;
+    fillTransformWorkspace(points, kind, ws);
+    m.used = ws.transformed.size();
+    if (ws.transformed.size() < 2)
+        return m;
+
+    // v = slope * u + intercept
+    auto [slope, intercept] = computeWeightedLinearRegression(ws.transformed);
+    if (kind == RegressionType::LOGARITHMIC)
+    {
+        m.a = intercept;
+        m.b = slope;
+    }
+    else
+    {
+        m.a = std::exp(static_cast<double>(intercept));
+        m.b = slope;
+    }
+    m.valid = std::isfinite(m.a) && std::isfinite(m.b);
+    if (m.valid && refine)
+        refineTransformModel(ws, m);
+    return m;
+}
+
+// ----------------------------------------
+// Пользовательская модель: компилятор формулы и Левенберг-Марквардт
+// ----------------------------------------
+
+// Формула вроде "a*sin(b*x)+c" компилируется один раз в байткод стековой
+// машины. x - аргумент, pi и e - константы, прочие имена - параметры
+// (в порядке первого появления).
+enum class ExprOp : std::uint8_t
+{
+    CONST, X, PARAM,
+    ADD, SUB, MUL, DIV, POW, NEG,
+    SIN, COS, TAN, EXP, LOG, SQRT, ABS, TANH
+};
+
+struct ExprInstr
+{
+    ExprOp op;
+    int index = 0;       // номер параметра для PARAM
+    double value = 0.0;  // значение для CONST
+};
+
+const int kMaxExprParams = 8;
+
+struct CompiledExpr
+{
+    bool valid = false;
+    std::string source;
+    std::string error;
+    std::vector<ExprInstr> code;
+    std::vector<std::string> paramNames;
+    int maxDepth = 0;
+};
+
+// Рекурсивный спуск: expr := term (+|- term)*, term := unary (*|/ unary)*,
+// unary := -unary | power, power := primary (^ unary)?, primary := число | имя | имя(expr) | (expr)
+struct ExprParser
+{
+    const std::string& text;
+    size_t pos = 0;
+    CompiledExpr& out;
+    int depth = 0;
+
+    void skipSpaces()
+    {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+            ++pos;
+    }
+    bool accept(char c)
+    {
+        skipSpaces();
+        if (pos < text.size() && text[pos] == c)
+        {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+    bool fail(const std::string& message)
+    {
+        if (out.error.empty())
+            out.error = message + " at position " + std::to_string(pos);
+        return false;
+    }
+    void emit(ExprOp op, int index = 0, double value = 0.0)
+    {
+        out.code.push_back({op, index, value});
+        // Глубина стека: операнды кладут значение, бинарные операции снимают одно
+        if (op == ExprOp::CONST || op == ExprOp::X || op == ExprOp::PARAM)
+            out.maxDepth = std::max(out.maxDepth, ++depth);
+        else if (op == ExprOp::ADD || op == ExprOp::SUB || op == ExprOp::MUL ||
+                 op == ExprOp::DIV || op == ExprOp::POW)
+            --depth;
+    }
+
+    bool parseExpr()
+    {
+        if (!parseTerm())
+            return false;
+        while (true)
+        {
+            if (accept('+')) { if (!parseTerm()) return false; emit(ExprOp::ADD); }
+            else if (accept('-')) { if (!parseTerm()) return false; emit(ExprOp::SUB); }
+            else return true;
+        }
+    }
+    bool parseTerm()
+    {
+        if (!parseUnary())
+            return false;
+        while (true)
+        {
+            if (accept('*')) { if (!parseUnary()) return false; emit(ExprOp::MUL); }
+            else if (accept('/')) { if (!parseUnary()) return false; emit(ExprOp::DIV); }
+            else return true;
+        }
+    }
+    bool parseUnary()
+    {
+        if (accept('-'))
+        {
+            if (!parseUnary()) return false;
+            emit(ExprOp::NEG);
+            return true;
+        }
+        if (accept('+'))
+            return parseUnary();
+        return parsePower();
+    }
+    bool parsePower()
+    {
+        if (!parsePrimary())
+            return false;
+        if (accept('^'))
+        {
+            if (!parseUnary()) return false;
+            emit(ExprOp::POW);
+        }
+        return true;
+    }
+    bool parsePrimary()
+    {
+        skipSpaces();
+        if (pos >= text.size())
+            return fail("unexpected end");
+        if (accept('('))
+        {
+            if (!parseExpr()) return false;
+            return accept(')') || fail("expected ')'");
+        }
+        char c = text[pos];
+        if (std::isdigit(static_cast<unsigned char>(c)) || c == '.')
+        {
+            const char* begin = text.c_str() + pos;
+            char* end = nullptr;
+            double v = std::strtod(begin, &end);
+            if (end == begin)
+                return fail("bad number");
+            pos += end - begin;
+            emit(ExprOp::CONST, 0, v);
+            return true;
+        }
+        if (!std::isalpha(static_cast<unsigned char>(c)) && c != '_')
+            return fail(std::string("unexpected '") + c + "'");
+
+        size_t start = pos;
+        while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) || text[pos] == '_'))
+            ++pos;
+        std::string name = text.substr(start, pos - start);
+
+        static const std::pair<const char*, ExprOp> functions[] = {
+            {"sin", ExprOp::SIN}, {"cos", ExprOp::COS}, {"tan", ExprOp::TAN}, {"exp", ExprOp::EXP},
+            {"log", ExprOp::LOG}, {"ln", ExprOp::LOG}, {"sqrt", ExprOp::SQRT}, {"abs", ExprOp::ABS},
+            {"tanh", ExprOp::TANH}};
+        for (auto& f : functions)
+        {
+            if (name == f.first)
+            {
+                if (!accept('('))
+                    return fail("expected '(' after " + name);
+                if (!parseExpr()) return false;
+                if (!accept(')')) return fail("expected ')'");
+                emit(f.second);
+                return true;
+            }
+        }
+        skipSpaces();
+        if (pos < text.size() && text[pos] == '(')
+            return fail("unknown function " + name);
+        if (name == "x")
+            emit(ExprOp::X);
+        else if (name == "pi")
+            emit(ExprOp::CONST, 0, 3.14159265358979323846);
+        else if (name == "e")
+            emit(ExprOp::CONST, 0, 2.71828182845904523536);
+        else
+        {
+            auto it = std::find(out.paramNames.begin(), out.paramNames.end(), name);
+            if (it == out.paramNames.end())
+            {
+                if (static_cast<int>(out.paramNames.size()) >= kMaxExprParams)
+                    return fail("too many parameters");
+                out.paramNames.push_back(name);
+                it = out.paramNames.end() - 1;
+            }
+            emit(ExprOp::PARAM, static_cast<int>(it - out.paramNames.begin()));
+        }
+        return true;
+    }
+};
+
+CompiledExpr compileExpression(const std::string& text)
+{
+    CompiledExpr expr;
+    expr.source = text;
+    ExprParser parser{text, 0, expr};
+    bool ok = parser.parseExpr();
+    parser.skipSpaces();
+    if (ok && parser.pos != text.size())
+        ok = parser.fail("unexpected trailing input");
+    expr.valid = ok && !expr.code.empty();
+    if (!expr.valid && expr.error.empty())
+        expr.error = "empty formula";
+    return expr;
+}
+
+// Размер пачки точек, по которой байткод исполняется за раз: каждая
+// инструкция - плотный цикл по пачке, который компилятор векторизует
+const size_t kExprBatch = 64;
+
+// Значения и (если jac != nullptr) производные по параметрам в count точках.
+// Производные - прямым автодифференцированием: рядом со значением на стеке
+// лежат его производные по всем параметрам. jac[i * P + k] = df/dp_k в точке i.
+// stack - рабочий буфер вызывающего, переиспользуется между вызовами.
+// Выбор операции делается один раз на инструкцию, внутри - плотные циклы по пачке.
+void evaluateExprBatch(const CompiledExpr& expr, const double* params, const Point* points, size_t count,
+                       double* values, double* jac, std::vector<double>& stack)
+{
+    const int P = jac ? static_cast<int>(expr.paramNames.size()) : 0;
+    const size_t B = kExprBatch;
+    const int depth = std::max(expr.maxDepth, 1);
+    // На уровень стека: B значений и P*B производных
+    const size_t needed = static_cast<size_t>(depth) * (P + 1) * B;
+    if (stack.size() < needed)
+        stack.resize(needed);
+    double* const mem = stack.data();
+    auto val = [&](int level) { return mem + static_cast<size_t>(level) * (P + 1) * B; };
+    auto der = [&](int level, int k) { return mem + (static_cast<size_t>(level) * (P + 1) + 1 + k) * B; };
+
+    size_t nb = 0;
+    int top = -1;
+    // Положить на стек константу (производные - 0, у параметра - 1 по нему самому)
+    auto pushConstant = [&](double value, int paramIndex)
+    {
+        ++top;
+        std::fill(val(top), val(top) + nb, value);
+        for (int k = 0; k < P; ++k)
+            std::fill(der(top, k), der(top, k) + nb, (k == paramIndex) ? 1.0 : 0.0);
+    };
+    // Бинарная операция над двумя верхними уровнями: сначала производные
+    // (нужны старые a и b), потом значения; результат на месте a
+    auto applyBinary = [&](auto derivative, auto function)
+    {
+        double* a = val(top - 1);
+        const double* b = val(top);
+        for (int k = 0; k < P; ++k)
+        {
+            double* da = der(top - 1, k);
+            const double* db = der(top, k);
+            for (size_t i = 0; i < nb; ++i)
+                da[i] = derivative(a[i], b[i], da[i], db[i]);
+        }
+        for (size_t i = 0; i < nb; ++i)
+            a[i] = function(a[i], b[i]);
+        --top;
+    };
+    // Унарная функция f с производной g: da *= g(a), a = f(a)
+    auto applyUnary = [&](auto derivative, auto function)
+    {
+        double* a = val(top);
+        for (int k = 0; k < P; ++k)
+        {
+            double* da = der(top, k);
+            for (size_t i = 0; i < nb; ++i)
+                da[i] *= derivative(a[i]);
+        }
+        for (size_t i = 0; i < nb; ++i)
+            a[i] = function(a[i]);
+    };
+
+    for (size_t base = 0; base < count; base += B)
+    {
+        nb = std::min(B, count - base);
+        top = -1;
+        for (const ExprInstr& ins : expr.code)
+        {
+            switch (ins.op)
+            {
+            case ExprOp::CONST:
+                pushConstant(ins.value, -1);
+                break;
+            case ExprOp::PARAM:
+                pushConstant(params[ins.index], ins.index);
+                break;
+            case ExprOp::X:
+            {
+                ++top;
+                double* v = val(top);
+                for (size_t i = 0; i < nb; ++i)
+                    v[i] = points[base + i].x;
+                for (int k = 0; k < P; ++k)
+                    std::fill(der(top, k), der(top, k) + nb, 0.0);
+                break;
+            }
+            case ExprOp::ADD:
+                applyBinary([](double, double, double da, double db) { return da + db; },
+                            [](double a, double b) { return a + b; });
+                break;
+            case ExprOp::SUB:
+                applyBinary([](double, double, double da, double db) { return da - db; },
+                            [](double a, double b) { return a - b; });
+                break;
+            case ExprOp::MUL:
+                applyBinary([](double a, double b, double da, double db) { return da * b + a * db; },
+                            [](double a, double b) { return a * b; });
+                break;
+            case ExprOp::DIV:
+                applyBinary([](double a, double b, double da, double db) { return (da * b - a * db) / (b * b); },
+                            [](double a, double b) { return a / b; });
+                break;
+            case ExprOp::POW:
+                applyBinary([](double a, double b, double da, double db)
+                            {
+                                return (a > 0.0) ? std::pow(a, b) * (db * std::log(a) + b * da / a)
+                                                 : b * std::pow(a, b - 1.0) * da;
+                            },
+                            [](double a, double b) { return std::pow(a, b); });
+                break;
+            case ExprOp::NEG:
+                applyUnary([](double) { return -1.0; }, [](double v) { return -v; });
+                break;
+            case ExprOp::SIN:
+                applyUnary([](double v) { return std::cos(v); }, [](double v) { return std::sin(v); });
+                break;
+            case ExprOp::COS:
+                applyUnary([](double v) { return -std::sin(v); }, [](double v) { return std::cos(v); });
+                break;
+            case ExprOp::TAN:
+                applyUnary([](double v) { return 1.0 / (std::cos(v) * std::cos(v)); },
+                           [](double v) { return std::tan(v); });
+                break;
+            case ExprOp::EXP:
+                applyUnary([](double v) { return std::exp(v); }, [](double v) { return std::exp(v); });
+                break;
+            case ExprOp::LOG:
+                applyUnary([](double v) { return 1.0 / v; }, [](double v) { return std::log(v); });
+                break;
+            case ExprOp::SQRT:
+                applyUnary([](double v) { return 0.5 / std::sqrt(v); }, [](double v) { return std::sqrt(v); });
+                break;
+            case ExprOp::ABS:
+                applyUnary([](double v) { return (v < 0.0) ? -1.0 : 1.0; }, [](double v) { return std::fabs(v); });
+                break;
+            case ExprOp::TANH:
+                applyUnary([](double v) { double t = std::tanh(v); return 1.0 - t * t; },
+                           [](double v) { return std::tanh(v); });
+                break;
+            }
+        }
+
+        std::copy(val(0), val(0) + nb, values + base);
+        for (int k = 0; k < P; ++k)
+        {
+            const double* d = der(0, k);
+            for (size_t i = 0; i < nb; ++i)
+                jac[(base + i) * P + k] = d[i];
+        }
+    }
+}
+
+// Значение формулы в одной точке (для кривой и предсказания по X)
+float evaluateCompiledExpr(const CompiledExpr& expr, const std::vector<double>& params, float x)
+{
+    if (!expr.valid)
+        return 0.f;
+    // Вызывается поточечно (кривая, диагностика), в том числе из пула:
+    // у каждого потока свой буфер стека, без выделения памяти на вызов
+    thread_local std::vector<double> stack;
+    Point p{x, 0.f};
+    double v;
+    evaluateExprBatch(expr, params.data(), &p, 1, &v, nullptr, stack);
+    return static_cast<float>(v);
+}
+
+struct CustomFit
+{
+    CompiledExpr expr;
+    std::vector<double> params;
+    double sse = std::numeric_limits<double>::infinity();
+    int iterations = 0;
+    bool converged = false;
+};
+
+// Суммы для шага LM: J^T W J (P*P), J^T W r (P) и взвешенная сумма квадратов.
+// Остатки и якобиан считаются кусками по kReductionBlock точек в пуле,
+// суммы складываются детерминированным деревом.
+std::vector<double> accumulateNormalSystem(const CompiledExpr& expr, const std::vector<double>& params,
+                                           const std::vector<Point>& points)
+{
+    const int P = static_cast<int>(params.size());
+    const size_t size = P * P + P + 1;
+    return deterministicReduce(points.size(), std::vector<double>(size, 0.0), [&](size_t lo, size_t hi)
+    {
+        std::vector<double> s(size, 0.0);
+        std::vector<double> values(hi - lo), jac((hi - lo) * P), stack;
+        evaluateExprBatch(expr, params.data(), points.data() + lo, hi - lo, values.data(), jac.data(), stack);
+        for (size_t i = 0; i < hi - lo; ++i)
+        {
+            double w = points[lo + i].w;
+            double r = points[lo + i].y - values[i];
+            const double* J = &jac[i * P];
+            for (int a = 0; a < P; ++a)
+            {
+                for (int b = 0; b <= a; ++b)
+                    s[a * P + b] += w * J[a] * J[b];
+                s[P * P + a] += w * J[a] * r;
+            }
+            s[P * P + P] += w * r * r;
+        }
+        for (int a = 0; a < P; ++a)
+            for (int b = 0; b < a; ++b)
+                s[b * P + a] = s[a * P + b];
+        return s;
+    }, [](std::vector<double>& acc, const std::vector<double>& part)
+    {
+        for (size_t k = 0; k < acc.size(); ++k)
+            acc[k] += part[k];
+    });
+}
+
+// Левенберг-Марквардт: (J^T J + mu * diag(J^T J)) delta = J^T r
+void levenbergMarquardt(const std::vector<Point>& points, CustomFit& fit, int maxIterations)
+{
+    const int P = static_cast<int>(fit.params.size());
+    std::vector<double> sys = accumulateNormalSystem(fit.expr, fit.params, points);
+    fit.sse = sys[P * P + P];
+    double mu = 1e-3;
+    for (int it = 0; it < maxIterations && std::isfinite(fit.sse); ++it)
+    {
+        fit.iterations = it + 1;
+        bool accepted = false;
+        while (mu < 1e12)
+        {
+            std::vector<double> A(sys.begin(), sys.begin() + P * P);
+            for (int k = 0; k < P; ++k)
+                A[k * P + k] += mu * std::max(A[k * P + k], 1e-12);
+            std::vector<double> delta(sys.begin() + P * P, sys.begin() + P * P + P);
+            if (choleskyDecompose(A, P))
+            {
+                choleskySolve(A, P, delta);
+                std::vector<double> trial = fit.params;
+                for (int k = 0; k < P; ++k)
+                    trial[k] += delta[k];
+                std::vector<double> next = accumulateNormalSystem(fit.expr, trial, points);
+                if (std::isfinite(next[P * P + P]) && next[P * P + P] < fit.sse)
+                {
+                    double gain = fit.sse - next[P * P + P];
+                    fit.params = trial;
+                    fit.sse = next[P * P + P];
+                    sys = std::move(next);
+                    mu = std::max(mu * 0.3, 1e-12);
+                    accepted = true;
+                    if (gain <= 1e-12 * fit.sse)
+                        fit.converged = true;
+                    break;
+                }
+            }
+            mu *= 10.0;
+        }
+        if (!accepted || fit.converged)
+        {
+            fit.converged = true;
+            break;
+        }
+    }
+}
+
+// Подгонка формулы: несколько стартов (все параметры 1 и случайные наборы)
+// на прореженной выборке, затем LM от лучшего старта по всем точкам
+CustomFit fitCustomModel(const std::vector<Point>& points, const CompiledExpr& expr)
+{
+    CustomFit best;
+    best.expr = expr;
+    const size_t P = expr.paramNames.size();
+    best.params.assign(P, 1.0);
+    if (!expr.valid || points.empty())
+        return best;
+    if (P == 0)
+    {
+        best.sse = accumulateNormalSystem(expr, best.params, points)[0];
+        best.converged = true;
+        return best;
+    }
+
+    const size_t kStartSample = 2000;
+    std::vector<Point> sample;
+    size_t stride = std::max<size_t>(1, points.size() / kStartSample);
+    for (size_t i = 0; i < points.size(); i += stride)
+        sample.push_back(points[i]);
+
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<double> start(-3.0, 3.0);
+    CustomFit bestStart = best;
+    for (int s = 0; s < 8; ++s)
+    {
+        CustomFit trial = best;
+        if (s > 0)
+            for (auto& p : trial.params)
+                p = start(rng);
+        levenbergMarquardt(sample, trial, 50);
+        if (trial.sse < bestStart.sse)
+            bestStart = trial;
+    }
+
+    best.params = bestStart.params;
+    best.converged = false;
+    levenbergMarquardt(points, best, 100);
+    return best;
+}
+
+// ----------------------------------------
+// Регрессия Деминга / полные наименьшие квадраты (ошибки и в x, и в y)
+// ----------------------------------------
+
+const int kMaxTLSDegree = 4;
+
+// Центрированные ковариации столбцов t^1..t^d и y (t = (x - center) / scale):
+// второй проход от уже известных средних, без вычитания E[ab] - E[a]E[b],
+// которое при больших средних y съедает все значащие цифры
+std::vector<double> centeredPowerCovariance(const std::vector<Point>& points, int degree, double center,
+                                            double scale, const std::vector<double>& meanT, double meanY)
+{
+    const int K = degree + 1;
+    const double invScale = 1.0 / scale;
+    std::vector<double> C = deterministicReduce(points.size(), std::vector<double>(K * K, 0.0),
+        [&](size_t lo, size_t hi)
+        {
+            std::vector<double> acc(K * K, 0.0);
+            double col[kMaxAutoDegree + 2];
+            for (size_t i = lo; i < hi; ++i)
+            {
+                double t = (points[i].x - center) * invScale, tk = 1.0;
+                for (int a = 1; a <= degree; ++a)
+                {
+                    tk *= t;
+                    col[a - 1] = tk - meanT[a];
+                }
+                col[degree] = points[i].y - meanY;
+                double w = points[i].w;
+                for (int a = 0; a < K; ++a)
+                    for (int b = 0; b <= a; ++b)
+                        acc[a * K + b] += w * col[a] * col[b];
+            }
+            return acc;
+        },
+        [](std::vector<double>& acc, const std::vector<double>& part)
+        {
+            for (size_t k = 0; k < acc.size(); ++k)
+                acc[k] += part[k];
+        });
+    for (int a = 0; a < K; ++a)
+        for (int b = 0; b < a; ++b)
+            C[b * K + a] = C[a * K + b];
+    return C;
+}
+
+// Ошибки в обеих переменных: delta = дисперсия ошибки y / дисперсия ошибки x
+// (delta = 1 - ортогональная регрессия). Средние - из прохода степенных моментов,
+// ковариации - вторым центрированным проходом. Степень 1 - прямая Деминга в
+// замкнутом виде в единицах x. Для степени d полные МНК определены на
+// нормированных степенях: минимизируется ||[t - mean, ..., t^d - mean,
+// (y - mean) / sqrt(delta)] v|| при |v| = 1, t = (x - center) / scale в [-1, 1].
+// Столбцы t^a порядка единицы, поэтому Якоби их различает (в сырых x^a элементы
+// доходили бы до scale^(2d)); v - собственный вектор с наименьшим числом.
+PolyModel computeDemingRegression(const std::vector<Point>& points, int degree, double delta = 1.0)
+{
+    PolyModel model;
+    degree = std::max(1, std::min(degree, kMaxTLSDegree));
+    if (points.size() <= static_cast<size_t>(degree) || !(delta > 0.0))
+        return model;
+
+    double center, scale;
+    choosePolynomialScaling(points, center, scale);
+    PowerMoments m = accumulatePowerMomentsParallel(points, nullptr, degree, center, scale);
+    const double W = m.St[0];
+    if (!(W > 0.0))
+        return model;
+
+    const int K = degree + 1;
+    std::vector<double> meanT(K);
+    for (int a = 0; a < K; ++a)
+        meanT[a] = m.St[a] / W;
+    const double meanY = m.Sty[0] / W;
+
+    std::vector<double> C = centeredPowerCovariance(points, degree, center, scale, meanT, meanY);
+    for (double& c : C)
+        c /= W;
+
+    std::vector<double> beta(K, 0.0); // коэффициенты при (t^a - mean t^a)
+    if (degree == 1)
+    {
+        // Деминг в единицах x: u = t * scale
+        double sxx = C[0] * scale * scale, sxy = C[1] * scale, syy = C[3];
+        if (sxy == 0.0)
+            beta[1] = 0.0;
+        else
+        {
+            double d = syy - delta * sxx;
+            beta[1] = (d + std::sqrt(d * d + 4.0 * delta * sxy * sxy)) / (2.0 * sxy) * scale;
+        }
+    }
+    else
+    {
+        const double invRootDelta = 1.0 / std::sqrt(delta);
+        for (int a = 0; a < K; ++a)
+        {
+            C[a * K + degree] *= invRootDelta;
+            C[degree * K + a] *= invRootDelta;
+        }
+        std::vector<double> values, vectors;
+        symmetricEigen(C, K, values, vectors);
+        int smallest = static_cast<int>(std::min_element(values.begin(), values.end()) - values.begin());
+        double vy = vectors[degree * K + smallest];
+        if (std::fabs(vy) < 1e-12)
+            return model; // решение "вертикальное": y не выражается через x
+        for (int a = 1; a <= degree; ++a)
+            beta[a] = -std::sqrt(delta) * vectors[(a - 1) * K + smallest] / vy;
+    }
+
+    model.degree = degree;
+    model.center = center;
+    model.scale = scale;
+    model.coeffs.assign(K, 0.0);
+    model.coeffs[0] = meanY;
+    for (int a = 1; a <= degree; ++a)
+    {
+        model.coeffs[a] = beta[a];
+        model.coeffs[0] -= beta[a] * meanT[a];
+    }
+    return model;
+}
+
+// ----------------------------------------
+// Квантильная регрессия (медиана, p90, p99) через IRLS
+// ----------------------------------------
+
+// Квантили, которые строятся в режиме U: медиана - основная кривая,
+// остальные - полоса над ней
+const std::vector<double> kBandQuantiles = {0.5, 0.9, 0.99};
+
+struct QuantileFit
+{
+    std::vector<double> taus;
+    std::vector<PolyModel> models; // по одной модели на квантиль
+    std::vector<char> converged;   // 0 - упёрлись в maxIterations или вырожденная система
+    int iterations = 0;
+};
+
+// Минимизирует сумму rho_tau(r) = r * (tau - [r < 0]) для всех квантилей сразу.
+// IRLS: вес точки tau / |r| (или (1 - tau) / |r| под кривой), |r| не меньше eps.
+// На каждой итерации один проход по данным: в каждом блоке для всех ещё не
+// сошедшихся квантилей считаются веса и взвешенные моменты (тот же
+// accumulatePowerMoments, что и у МНК), блоки складываются детерминированно.
+QuantileFit computeQuantileRegressions(const std::vector<Point>& points, int degree,
+                                       const std::vector<double>& taus, int maxIterations = 50)
+{
+    QuantileFit fit;
+    fit.taus = taus;
+    PolyModel start = computeLeastSquaresPoly(points, degree);
+    if (start.coeffs.empty() || taus.empty())
+        return fit;
+
+    // Порог для |r|: малая доля типичного остатка МНК
+    std::vector<double> residuals;
+    computeResiduals(points, start, residuals);
+    double eps = 1e-6 * robustScale(residuals, points);
+    if (!(eps > 0.0))
+        eps = 1e-12;
+
+    // Старт: прямая МНК, сдвинутая на tau-квантиль её остатков. Для p99
+    // это почти ответ, а из самой МНК IRLS шёл бы к краю сотни итераций.
+    std::vector<std::pair<double, double>> sorted(points.size());
+    double total = 0.0;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        sorted[i] = {residuals[i], points[i].w};
+        total += points[i].w;
+    }
+    std::sort(sorted.begin(), sorted.end());
+    fit.models.assign(taus.size(), start);
+    for (size_t q = 0; q < taus.size(); ++q)
+    {
+        double acc = 0.0;
+        for (auto& [r, w] : sorted)
+        {
+            acc += w;
+            if (acc >= taus[q] * total)
+            {
+                fit.models[q].coeffs[0] += r;
+                break;
+            }
+        }
+    }
+
+    // Проход по данным: взвешенные моменты и текущая потеря для каждого квантиля
+    struct QuantilePass
+    {
+        std::vector<PowerMoments> moments;
+        std::vector<double> loss;
+    };
+    const size_t Q = taus.size();
+    std::vector<char> active(Q, 1);
+    fit.converged.assign(Q, 0);
+    // IRLS не обязан монотонно уменьшать потерю: храним лучшую модель
+    // каждого квантиля и при остановке возвращаем её, а не последнюю
+    std::vector<double> prevLoss(Q, std::numeric_limits<double>::infinity());
+    std::vector<double> bestLoss(Q, std::numeric_limits<double>::infinity());
+    std::vector<PolyModel> best = fit.models;
+    for (int iter = 0; iter < maxIterations; ++iter)
+    {
+        fit.iterations = iter + 1;
+        QuantilePass pass = deterministicReduce(points.size(), QuantilePass{}, [&](size_t lo, size_t hi)
+        {
+            QuantilePass part{std::vector<PowerMoments>(Q), std::vector<double>(Q, 0.0)};
+            std::vector<double> weights(hi - lo);
+            for (size_t q = 0; q < Q; ++q)
+            {
+                if (!active[q])
+                    continue;
+                const PolyModel& model = fit.models[q];
+                for (size_t i = lo; i < hi; ++i)
+                {
+                    double r = points[i].y - evaluatePolyModel(model, points[i].x);
+                    double a = (r >= 0.0) ? taus[q] : 1.0 - taus[q];
+                    part.loss[q] += points[i].w * a * std::fabs(r);
+                    weights[i - lo] = a / std::max(std::fabs(r), eps);
+                }
+                part.moments[q] = accumulatePowerMoments(points.data() + lo, hi - lo, degree, model.center,
+                                                         model.scale, weights.data());
+            }
+            return part;
+        }, [](QuantilePass& acc, const QuantilePass& part)
+        {
+            for (size_t q = 0; q < acc.moments.size(); ++q)
+            {
+                addMoments(acc.moments[q], part.moments[q]);
+                acc.loss[q] += part.loss[q];
+            }
+        });
+
+        bool any = false;
+        for (size_t q = 0; q < Q; ++q)
+        {
+            if (!active[q])
+                continue;
+            if (pass.loss[q] < bestLoss[q])
+            {
+                bestLoss[q] = pass.loss[q];
+                best[q] = fit.models[q];
+            }
+            // Потеря почти перестала падать - модель сошлась
+            if (pass.loss[q] >= prevLoss[q] * (1.0 - 1e-6))
+            {
+                active[q] = 0;
+                fit.converged[q] = 1;
+                continue;
+            }
+            prevLoss[q] = pass.loss[q];
+
+            // Веса определены с точностью до множителя; нормируем их сумму
+            // к числу точек, чтобы проверка вырожденности в решателе работала
+            PowerMoments& m = pass.moments[q];
+            double norm = static_cast<double>(points.size()) / m.St[0];
+            for (double& v : m.St)
+                v *= norm;
+            for (double& v : m.Sty)
+                v *= norm;
+            m.Syy *= norm;
+
+            PolyModel next;
+            if (!solvePolynomialFromMoments(m, degree, next))
+            {
+                active[q] = 0;
+                continue;
+            }
+            double change = 0.0, scaleNorm = 0.0;
+            for (int k = 0; k <= degree; ++k)
+            {
+                change = std::max(change, std::fabs(next.coeffs[k] - fit.models[q].coeffs[k]));
+                scaleNorm = std::max(scaleNorm, std::fabs(next.coeffs[k]));
+            }
+            fit.models[q] = next;
+            if (change <= 1e-7 * std::max(scaleNorm, 1.0))
+            {
+                active[q] = 0;
+                fit.converged[q] = 1;
+            }
+            any = any || active[q];
+        }
+        if (!any)
+            break;
+    }
+    // Последний шаг потерю не проверял (сошёлся по коэффициентам или лимит итераций)
+    // - он может быть хуже лучшей оценённой модели
+    for (size_t q = 0; q < Q; ++q)
+        if (bestLoss[q] < std::numeric_limits<double>::infinity())
+            fit.models[q] = best[q];
+    return fit;
+}
+
+// ----------------------------------------
+// Изотоническая (монотонная) регрессия: PAVA
+// ----------------------------------------
+
+// Ступенчатая функция: на [start[k], start[k+1]) значение value[k]
+struct IsotonicModel
+{
+    bool increasing = true;
+    std::vector<double> start;  // левые x блоков, по возрастанию
+    std::vector<double> end;    // правые x блоков (последняя точка блока)
+    std::vector<double> value;
+};
+
+// Pool-adjacent-violators за O(N) по точкам, отсортированным по x (общее
+// хранилище передаётся как есть, иначе сортируется копия). Точки с равным x
+// сначала сливаются в одну. Направление - по знаку наклона МНК.
+IsotonicModel computeIsotonicRegression(const std::vector<Point>& points)
+{
+    IsotonicModel model;
+    if (points.empty())
+        return model;
+    std::vector<Point> scratch;
+    const std::vector<Point>& sorted = sortedByX(points, scratch);
+    model.increasing = computeWeightedLinearRegression(sorted).first >= 0.f;
+    const double sign = model.increasing ? 1.0 : -1.0;
+
+    // Стек блоков: сумма w*y (в знаке направления), сумма w, границы
+    std::vector<double> sumWY, sumW;
+    for (size_t i = 0; i < sorted.size();)
+    {
+        double wy = 0.0, w = 0.0;
+        double x = sorted[i].x;
+        for (; i < sorted.size() && sorted[i].x == x; ++i)
+        {
+            wy += sorted[i].w * sign * sorted[i].y;
+            w += sorted[i].w;
+        }
+        model.start.push_back(x);
+        model.end.push_back(x);
+        sumWY.push_back(wy);
+        sumW.push_back(w);
+        // Сливаем, пока предыдущий блок не ниже текущего
+        while (sumW.size() > 1)
+        {
+            size_t k = sumW.size() - 1;
+            if (sumWY[k - 1] * sumW[k] < sumWY[k] * sumW[k - 1])
+                break;
+            sumWY[k - 1] += sumWY[k];
+            sumW[k - 1] += sumW[k];
+            model.end[k - 1] = model.end[k];
+            sumWY.pop_back();
+            sumW.pop_back();
+            model.start.pop_back();
+            model.end.pop_back();
+        }
+    }
+
+    model.value.resize(sumW.size());
+    for (size_t k = 0; k < sumW.size(); ++k)
+        model.value[k] = sign * sumWY[k] / sumW[k];
+    return model;
+}
+
+// Номер блока, действующего в точке x (левее первого блока - первый)
+size_t isotonicBlock(const IsotonicModel& m, double x)
+{
+    size_t k = std::upper_bound(m.start.begin(), m.start.end(), x) - m.start.begin();
+    return (k == 0) ? 0 : k - 1;
+}
+
+float evaluateIsotonic(const IsotonicModel& m, float x)
+{
+    if (m.value.empty())
+        return 0.f;
+    return static_cast<float>(m.value[isotonicBlock(m, x)]);
+}
+
+// Пачка значений: двоичный поиск блока для первого x куска, дальше для
+// возрастающих x блок только сдвигается вперёд
+void evaluateIsotonicBatch(const IsotonicModel& m, const float* xs, float* out, size_t count)
+{
+    if (m.value.empty())
+    {
+        std::fill(out, out + count, 0.f);
+        return;
+    }
+    parallelForChunks(count, 4096, [&](size_t, size_t lo, size_t hi)
+    {
+        size_t k = 0;
+        for (size_t q = lo; q < hi; ++q)
+        {
+            double x = xs[q];
+            if (q == lo || x < m.start[k])
+                k = isotonicBlock(m, x);
+            while (k + 1 < m.start.size() && x >= m.start[k + 1])
+                ++k;
+            out[q] = static_cast<float>(m.value[k]);
+        }
+    });
+}
+
+// ----------------------------------------
+// Логистическая регрессия для целевых 0/1: Ньютон (IRLS)
+// ----------------------------------------
+
+// P(y = 1 | x) = sigmoid(sum coeffs[k] * t^k), t = (x - center) / scale
+struct LogisticModel
+{
+    PolyModel linear;          // линейный предиктор в масштабированной переменной
+    bool valid = false;
+    bool converged = false;
+    int iterations = 0;
+    double logLikelihood = 0.0;
+};
+
+// exp(z) при -700 <= z <= 0 без вызова libm: z = k*ln2 + r, |r| <= ln2/2, exp(r) -
+// ряд Тейлора до r^11 (ошибка ~1e-15), 2^k собирается прямо в битах показателя.
+// Округление k - сдвигом на 1.5*2^52, поэтому ни одной ветки и преобразования
+// double -> int: циклы с этой функцией векторизуются. Ограничение z - забота
+// вызывающего (сравнение внутри такого цикла gcc векторизовать отказывается).
+inline double fastExpNonPositive(double z)
+{
+    const double kShift = 6755399441055744.0; // 1.5 * 2^52
+    double kd = z * 1.4426950408889634 + kShift;
+    double k = kd - kShift;
+    double r = (z - k * 0.6931471803691238) - k * 1.9082149292705877e-10;
+    double p = 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    std::uint64_t bits, shiftBits;
+    std::memcpy(&bits, &kd, sizeof(bits));
+    std::memcpy(&shiftBits, &kShift, sizeof(shiftBits));
+    bits = (bits - shiftBits + 1023) << 52;
+    double scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+// ln(1 + u) при u в [0, 1]: 2*atanh(s), s = u / (2 + u) <= 1/3, ряд до s^37
+inline double fastLog1pUnit(double u)
+{
+    double s = u / (2.0 + u);
+    double s2 = s * s;
+    double p = 1.0 / 37.0;
+    p = p * s2 + 1.0 / 35.0;
+    p = p * s2 + 1.0 / 33.0;
+    p = p * s2 + 1.0 / 31.0;
+    p = p * s2 + 1.0 / 29.0;
+    p = p * s2 + 1.0 / 27.0;
+    p = p * s2 + 1.0 / 25.0;
+    p = p * s2 + 1.0 / 23.0;
+    p = p * s2 + 1.0 / 21.0;
+    p = p * s2 + 1.0 / 19.0;
+    p = p * s2 + 1.0 / 17.0;
+    p = p * s2 + 1.0 / 15.0;
+    p = p * s2 + 1.0 / 13.0;
+    p = p * s2 + 1.0 / 11.0;
+    p = p * s2 + 1.0 / 9.0;
+    p = p * s2 + 1.0 / 7.0;
+    p = p * s2 + 1.0 / 5.0;
+    p = p * s2 + 1.0 / 3.0;
+    p = p * s2 + 1.0;
+    return 2.0 * s * p;
+}
+
+// Градиент, гессиан и логарифм правдоподобия в одной точке beta.
+// Гессиан для признаков t^k определяется моментами hess[m] = sum v*t^m, m = 0..2d.
+struct LogisticPass
+{
+    std::vector<double> grad;  // sum w*(y - p)*t^k
+    std::vector<double> hess;  // sum w*p*(1-p)*t^m
+    double logLikelihood = 0.0;
+};
+
+void addLogisticPass(LogisticPass& acc, const LogisticPass& part)
+{
+    for (size_t k = 0; k < acc.grad.size(); ++k)
+        acc.grad[k] += part.grad[k];
+    for (size_t k = 0; k < acc.hess.size(); ++k)
+        acc.hess[k] += part.hess[k];
+    acc.logLikelihood += part.logLikelihood;
+}
+
+// Один слитный проход по блоку точек. Как в accumulatePowerMoments, точки идут
+// пачками, а все внутренние циклы - без зависимостей и без вызовов libm
+// (sigmoid через fastExpNonPositive от -|z|), так что компилятор их векторизует.
+LogisticPass logisticPassBlock(const Point* points, size_t count, const PolyModel& model)
+{
+    const int d = model.degree;
+    LogisticPass pass;
+    pass.grad.assign(d + 1, 0.0);
+    pass.hess.assign(2 * d + 1, 0.0);
+
+    const double invScale = 1.0 / model.scale;
+    const size_t kBlock = 256;
+    double t[kBlock], y[kBlock], w[kBlock], z[kBlock], a[kBlock], upper[kBlock];
+    double pv[kBlock], pr[kBlock], lv[kBlock];
+
+    for (size_t start = 0; start < count; start += kBlock)
+    {
+        size_t len = std::min(kBlock, count - start);
+        for (size_t i = 0; i < len; ++i)
+        {
+            t[i] = (points[start + i].x - model.center) * invScale;
+            y[i] = points[start + i].y;
+            w[i] = points[start + i].w;
+            z[i] = model.coeffs[d];
+        }
+        for (int k = d - 1; k >= 0; --k)
+            for (size_t i = 0; i < len; ++i)
+                z[i] = z[i] * t[i] + model.coeffs[k];
+
+        // Сравнения - в отдельном цикле: рядом с арифметикой gcc их в маски
+        // не превращает, и векторизация основного цикла срывается
+        for (size_t i = 0; i < len; ++i)
+        {
+            a[i] = std::min(std::fabs(z[i]), 700.0);
+            upper[i] = (z[i] >= 0.0) ? 1.0 : 0.0;
+        }
+
+        // Поэлементная часть отдельно от сумм: суммы double без -ffast-math
+        // не векторизуются и остановили бы весь цикл
+        for (size_t i = 0; i < len; ++i)
+        {
+            double e = fastExpNonPositive(-a[i]);
+            double inv = 1.0 / (1.0 + e);
+            // sigmoid(z) = 1/(1+e) при z >= 0 и e/(1+e) иначе
+            double q = e * inv;
+            double p = q + upper[i] * (inv - q);
+            // log L = y*z - ln(1 + exp(z)) = y*z - max(z, 0) - ln(1 + exp(-|z|))
+            lv[i] = w[i] * (y[i] * z[i] - upper[i] * z[i] - fastLog1pUnit(e));
+            pv[i] = w[i] * e * inv * inv;  // w*p*(1-p)
+            pr[i] = w[i] * (y[i] - p);
+        }
+        double ll = 0.0;
+        for (size_t i = 0; i < len; ++i)
+            ll += lv[i];
+        pass.logLikelihood += ll;
+
+        for (int k = 0; k <= 2 * d; ++k)
+        {
+            double sh = 0.0;
+            for (size_t i = 0; i < len; ++i)
+                sh += pv[i];
+            pass.hess[k] += sh;
+            for (size_t i = 0; i < len; ++i)
+                pv[i] *= t[i];
+
+            if (k <= d)
+            {
+                double sg = 0.0;
+                for (size_t i = 0; i < len; ++i)
+                    sg += pr[i];
+                pass.grad[k] += sg;
+                for (size_t i = 0; i < len; ++i)
+                    pr[i] *= t[i];
+            }
+        }
+    }
+    return pass;
+}
+
+LogisticPass logisticPass(const std::vector<Point>& points, const PolyModel& model)
+{
+    LogisticPass identity;
+    identity.grad.assign(model.degree + 1, 0.0);
+    identity.hess.assign(2 * model.degree + 1, 0.0);
+    return deterministicReduce(points.size(), identity, [&](size_t lo, size_t hi)
+    {
+        return logisticPassBlock(points.data() + lo, hi - lo, model);
+    }, addLogisticPass);
+}
+
+// Ньютон по максимуму правдоподобия: каждая итерация - один проход по данным.
+// Шаг делится пополам, пока правдоподобие не перестанет падать. Целевые значения
+// должны лежать в [0, 1] (доли с весом-числом испытаний тоже допустимы).
+LogisticModel computeLogisticRegression(const std::vector<Point>& points, int degree, int maxIterations = 50)
+{
+    LogisticModel result;
+    bool binary = std::all_of(points.begin(), points.end(),
+                              [](const Point& p) { return p.y >= 0.f && p.y <= 1.f; });
+    if (!binary || static_cast<int>(points.size()) <= degree)
+        return result;
+
+    PolyModel& model = result.linear;
+    model.degree = degree;
+    choosePolynomialScaling(points, model.center, model.scale);
+    model.coeffs.assign(degree + 1, 0.0);
+
+    const int n = degree + 1;
+    LogisticPass pass = logisticPass(points, model);
+    for (int it = 0; it < maxIterations; ++it)
+    {
+        std::vector<double> H(n * n), step = pass.grad;
+        double trace = 0.0;
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+                H[i * n + j] = pass.hess[i + j];
+        for (int i = 0; i < n; ++i)
+            trace += H[i * n + i];
+        // При разделимых данных p*(1-p) -> 0, поэтому небольшая добавка к диагонали
+        for (int i = 0; i < n; ++i)
+            H[i * n + i] += 1e-12 * trace + 1e-300;
+        if (!choleskyDecompose(H, n))
+            break;
+        choleskySolve(H, n, step);
+
+        // Ньютоновский декремент g*step/2 - ожидаемый прирост log L; когда он
+        // ничтожен, лишний проход не нужен
+        double decrement = 0.0;
+        for (int k = 0; k < n; ++k)
+            decrement += pass.grad[k] * step[k];
+        if (0.5 * decrement <= 1e-12 * (std::fabs(pass.logLikelihood) + 1.0))
+        {
+            result.converged = true;
+            break;
+        }
+        result.iterations = it + 1;
+
+        PolyModel trial = model;
+        LogisticPass trialPass;
+        bool improved = false;
+        for (int halving = 0; halving < 30; ++halving)
+        {
+            for (int k = 0; k < n; ++k)
+                trial.coeffs[k] = model.coeffs[k] + step[k];
+            trialPass = logisticPass(points, trial);
+            if (trialPass.logLikelihood >= pass.logLikelihood)
+            {
+                improved = true;
+                break;
+            }
+            for (double& s : step)
+                s *= 0.5;
+        }
+        if (!improved)
+        {
+            result.converged = true; // дальше правдоподобие не растёт
+            break;
+        }
+
+        model = trial;
+        pass = trialPass;
+    }
+
+    result.logLikelihood = pass.logLikelihood;
+    result.valid = true;
+    return result;
+}
+
+float evaluateLogistic(const LogisticModel& m, float x)
+{
+    if (!m.valid)
+        return 0.f;
+    double z = evaluatePolyModel(m.linear, x);
+    return static_cast<float>(1.0 / (1.0 + std::exp(-z)));
+}
+
+// Консольный режим --bench-logistic [N]: синтетические 0/1 с известными
+// коэффициентами, время подгонки и число итераций Ньютона
+int runLogisticBenchmark(size_t count)
+{
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::vector<Point> pts(count);
+    const double b0 = -3.0, b1 = 0.06; // P = sigmoid(b0 + b1*x), x в [0, 100]
+    for (auto& p : pts)
+    {
+        p.x = 100.f * uniform(rng);
+        double prob = 1.0 / (1.0 + std::exp(-(b0 + b1 * p.x)));
+        p.y = (uniform(rng) < prob) ? 1.f : 0.f;
+    }
+
+    auto t0 = std::chrono::steady_clock::now();
+    LogisticModel m = computeLogisticRegression(pts, 1);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // Коэффициенты при x из масштабированной переменной
+    double slope = m.linear.coeffs[1] / m.linear.scale;
+    double intercept = m.linear.coeffs[0] - slope * m.linear.center;
+    std::cout << count << " points: " << seconds << " s, " << m.iterations << " Newton iterations"
+              << (m.converged ? "" : " (not converged)") << std::endl;
+    std::cout << "intercept=" << intercept << " (true " << b0 << "), slope=" << slope
+              << " (true " << b1 << "), logL=" << m.logLikelihood << std::endl;
+    return 0;
+}
+
+// ----------------------------------------
+// Мини-пакетный SGD / Adam для потоков и файлов, не помещающихся в память
+// ----------------------------------------
+
+// Файл модели: текст из строк "ключ значения", по нему модель можно восстановить
+// без данных. Пишется во временный файл и переименовывается, чтобы прерванная
+// запись не портила прошлую контрольную точку.
+bool saveModelFile(const std::string& filename, const PolyModel& model, size_t rowsSeen)
+{
+    std::string tmp = filename + ".tmp";
+    {
+        std::ofstream file(tmp);
+        if (!file.is_open())
+        {
+            std::cerr << "Error: Unable to open model file " << tmp << std::endl;
+            return false;
+        }
+        file.precision(17);
+        file << "model polynomial\n"
+             << "degree " << model.degree << "\n"
+             << "center " << model.center << "\n"
+             << "scale " << model.scale << "\n"
+             << "coeffs";
+        for (double c : model.coeffs)
+            file << " " << c;
+        file << "\n" << "rows " << rowsSeen << "\n";
+        if (!file)
+            return false;
+    }
+    return std::rename(tmp.c_str(), filename.c_str()) == 0;
+}
+
+struct SGDOptions
+{
+    int degree = 1;
+    size_t batchSize = 256;
+    double learningRate = 0.01;
+    bool adam = true;            // иначе обычный SGD
+    int epochs = 1;              // для файла; поток из stdin читается один раз
+    size_t warmupRows = 10000;   // строки для начальной стандартизации
+    bool hogwild = false;        // мини-пакеты параллельно, без блокировок
+    size_t checkpointEvery = 0;  // пакетов между контрольными точками (0 - только в конце)
+    std::string checkpointFile;
+};
+
+bool polyModelIsFinite(const PolyModel& model)
+{
+    return std::all_of(model.coeffs.begin(), model.coeffs.end(), [](double c) { return std::isfinite(c); });
+}
+
+// Состояние обучения. Параметры и моменты Adam - атомики с relaxed-доступом:
+// при Hogwild потоки читают и пишут их без блокировок (на x86 это обычные mov),
+// а гонки между обновлениями алгоритм допускает.
+struct SGDState
+{
+    PowerMoments seen;             // моменты всех прочитанных строк в текущем базисе t
+    double minX = 0.0, maxX = 0.0;
+    StandardizedMoments standard;  // признаки z_k = (t^k - mean_k) / sd_k по seen
+    double sdY = 1.0;              // y обучается как (y - meanY) / sdY
+    std::vector<std::atomic<double>> params;  // [0] - свободный член, [k] - при z_k
+    std::vector<std::atomic<double>> m, v;    // моменты Adam
+    std::atomic<std::uint64_t> steps{0};      // для затухания шага
+    std::atomic<std::uint64_t> adamSteps{0};  // для поправки смещения; сбрасывается со сменой базиса
+
+    explicit SGDState(int degree) : params(degree + 1), m(degree + 1), v(degree + 1)
+    {
+        for (size_t k = 0; k < params.size(); ++k)
+        {
+            params[k].store(0.0, std::memory_order_relaxed);
+            m[k].store(0.0, std::memory_order_relaxed);
+            v[k].store(0.0, std::memory_order_relaxed);
+        }
+    }
+
+    PolyModel model() const
+    {
+        std::vector<double> beta(standard.degree);
+        for (int k = 1; k <= standard.degree; ++k)
+            beta[k - 1] = sdY * params[k].load(std::memory_order_relaxed);
+        PolyModel result = modelFromStandardized(standard, beta);
+        result.coeffs[0] += sdY * params[0].load(std::memory_order_relaxed);
+        return result;
+    }
+};
+
+// Переход к базису newCenter/newScale и стандартизации по всем прочитанным
+// строкам. Моменты и текущий полином пересчитываются точно (подстановка
+// t_old = g*t_new + h), параметры выражаются в новых признаках; моменты
+// Adam относятся к старым признакам и сбрасываются.
+void rebaseSGD(SGDState& state, double newCenter, double newScale)
+{
+    PowerMoments& seen = state.seen;
+    const int d = seen.maxDegree;
+    const double g = newScale / seen.scale, h = (newCenter - seen.center) / seen.scale;
+    bool hadModel = state.standard.degree > 0;
+    PolyModel old = hadModel ? state.model() : PolyModel{};
+
+    // E[t_new^k ...] = сумма по j коэффициентов (a*t_old + b)^k при t_old^j
+    const double a = 1.0 / g, b = -h / g;
+    std::vector<double> power = {1.0}, St(2 * d + 1, 0.0), Sty(d + 1, 0.0);
+    for (int k = 0; k <= 2 * d; ++k)
+    {
+        for (int j = 0; j <= k; ++j)
+        {
+            St[k] += power[j] * seen.St[j];
+            if (k <= d)
+                Sty[k] += power[j] * seen.Sty[j];
+        }
+        // (a*t + b)^(k+1) из (a*t + b)^k
+        power.push_back(0.0);
+        for (int j = k + 1; j >= 0; --j)
+            power[j] = (j > 0 ? a * power[j - 1] : 0.0) + b * power[j];
+    }
+    seen.St = St;
+    seen.Sty = Sty;
+    seen.center = newCenter;
+    seen.scale = newScale;
+
+    state.standard = standardizeMoments(seen, d);
+    double meanY = state.standard.meanY;
+    double varY = seen.Syy / seen.St[0] - meanY * meanY;
+    state.sdY = (varY > 0.0) ? std::sqrt(varY) : 1.0;
+
+    // Старый полином в новых признаках: c_k = sdY * b_k / sd_k,
+    // c_0 = meanY + sdY * (b_0 - сумма b_k * mean_k / sd_k)
+    std::vector<double> c = hadModel ? substituteAffine(old.coeffs, g, h) : std::vector<double>(d + 1, meanY);
+    double b0 = c[0] - meanY;
+    for (int k = 1; k <= d; ++k)
+    {
+        double bk = hadModel ? c[k] * state.standard.sd[k - 1] / state.sdY : 0.0;
+        state.params[k].store(bk, std::memory_order_relaxed);
+        b0 += (hadModel ? c[k] : 0.0) * state.standard.mean[k - 1];
+    }
+    state.params[0].store(b0 / state.sdY, std::memory_order_relaxed);
+    for (int k = 0; k <= d; ++k)
+    {
+        state.m[k].store(0.0, std::memory_order_relaxed);
+        state.v[k].store(0.0, std::memory_order_relaxed);
+    }
+    state.adamSteps.store(0, std::memory_order_relaxed);
+}
+
+// Учёт новой пачки в моментах. Если x вышел за текущий диапазон больше чем на
+// 10% масштаба или среднее/разброс y заметно сдвинулись (отсортированные по x
+// потоки и логи), базис и стандартизация обновляются. Без этого признаки
+// точек вдали от разогрева становятся огромными, и SGD уходит в NaN.
+void observeSGDBatch(SGDState& state, const std::vector<Point>& data)
+{
+    if (data.empty())
+        return;
+    bool first = state.standard.degree == 0;
+    for (auto& p : data)
+    {
+        state.minX = first ? p.x : std::min(state.minX, static_cast<double>(p.x));
+        state.maxX = first ? p.x : std::max(state.maxX, static_cast<double>(p.x));
+        first = false;
+    }
+    PowerMoments& seen = state.seen;
+    addMoments(seen, accumulatePowerMoments(data.data(), data.size(), seen.maxDegree, seen.center, seen.scale));
+
+    double lo = seen.center - seen.scale, hi = seen.center + seen.scale, margin = 0.1 * seen.scale;
+    bool rangeGrew = state.minX < lo - margin || state.maxX > hi + margin;
+    bool yMoved = true;
+    if (state.standard.degree > 0)
+    {
+        double meanY = seen.Sty[0] / seen.St[0];
+        double sdY = std::sqrt(std::max(seen.Syy / seen.St[0] - meanY * meanY, 0.0));
+        yMoved = std::fabs(meanY - state.standard.meanY) > 0.25 * state.sdY ||
+                 sdY > 1.25 * state.sdY || sdY < 0.8 * state.sdY;
+    }
+    if (!rangeGrew && !yMoved)
+        return;
+    double center = seen.center, scale = seen.scale;
+    if (rangeGrew || state.standard.degree == 0)
+    {
+        center = 0.5 * (state.minX + state.maxX);
+        scale = (state.maxX > state.minX) ? 0.5 * (state.maxX - state.minX) : 1.0;
+    }
+    rebaseSGD(state, center, scale);
+}
+
+// Один шаг по мини-пакету [lo, hi); возвращает сумму w*r^2 до шага в единицах y
+// (прогрессивная оценка ошибки)
+double sgdStep(SGDState& state, const SGDOptions& opt, const Point* points, size_t count)
+{
+    const StandardizedMoments& s = state.standard;
+    const int n = s.degree + 1;
+    double theta[kMaxAutoDegree + 1], grad[kMaxAutoDegree + 1] = {}, z[kMaxAutoDegree + 1];
+    for (int k = 0; k < n; ++k)
+        theta[k] = state.params[k].load(std::memory_order_relaxed);
+
+    double loss = 0.0, totalW = 0.0;
+    z[0] = 1.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        double t = (points[i].x - s.center) / s.scale;
+        double tk = 1.0, pred = theta[0];
+        for (int k = 1; k < n; ++k)
+        {
+            tk *= t;
+            z[k] = (tk - s.mean[k - 1]) / s.sd[k - 1];
+            pred += theta[k] * z[k];
+        }
+        double w = points[i].w;
+        double r = pred - (points[i].y - s.meanY) / state.sdY;
+        loss += w * r * r;
+        totalW += w;
+        for (int k = 0; k < n; ++k)
+            grad[k] += w * r * z[k];
+    }
+
+    // Шаг затухает как 1/sqrt(1 + step/1000): у Adam с постоянным шагом
+    // остаётся шум порядка самого шага
+    std::uint64_t step = state.steps.fetch_add(1, std::memory_order_relaxed) + 1;
+    std::uint64_t adamStep = state.adamSteps.fetch_add(1, std::memory_order_relaxed) + 1;
+    double rate = opt.learningRate / std::sqrt(1.0 + step / 1000.0);
+    for (int k = 0; k < n; ++k)
+    {
+        double g = grad[k] / totalW;
+        double delta = rate * g;
+        if (opt.adam)
+        {
+            const double beta1 = 0.9, beta2 = 0.999;
+            double mk = beta1 * state.m[k].load(std::memory_order_relaxed) + (1.0 - beta1) * g;
+            double vk = beta2 * state.v[k].load(std::memory_order_relaxed) + (1.0 - beta2) * g * g;
+            state.m[k].store(mk, std::memory_order_relaxed);
+            state.v[k].store(vk, std::memory_order_relaxed);
+            double mHat = mk / (1.0 - std::pow(beta1, static_cast<double>(adamStep)));
+            double vHat = vk / (1.0 - std::pow(beta2, static_cast<double>(adamStep)));
+            delta = rate * mHat / (std::sqrt(vHat) + 1e-8);
+        }
+        // Hogwild: читаем свежее значение, другие потоки могли его сдвинуть
+        state.params[k].store(state.params[k].load(std::memory_order_relaxed) - delta,
+                              std::memory_order_relaxed);
+    }
+    return loss * state.sdY * state.sdY;
+}
+
+// Обучение на потоке. Разогрев задаёт начальный центр/масштаб x, средние и
+// разброс признаков t^k и y (при x ~ 2e5 сырой SGD расходится); дальше они
+// уточняются по всем прочитанным строкам (observeSGDBatch), а обучение идёт
+// мини-пакетами. С Hogwild пачка из нескольких мини-пакетов на поток
+// раздаётся пулу, и потоки обновляют общие параметры без блокировок.
+int runSGDTrainer(const std::string& filename, const SGDOptions& opt)
+{
+    if (opt.degree < 1 || opt.degree > kMaxAutoDegree || opt.batchSize == 0)
+    {
+        std::cerr << "Error: degree must be 1.." << kMaxAutoDegree << " and batch size positive" << std::endl;
+        return 1;
+    }
+    CSVPointStream stream(filename);
+    if (!stream.isOpen())
+    {
+        std::cerr << "Error: Unable to open file " << filename << std::endl;
+        return 1;
     }
 
-    std::string line;
-    while (std::getline(file, line))
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Point> warmup;
+    stream.nextBatch(warmup, std::max(opt.warmupRows, opt.batchSize));
+    if (warmup.size() <= static_cast<size_t>(opt.degree))
     {
-        if (line.empty()) 
-            continue;
+        std::cerr << "Error: not enough rows in " << filename << std::endl;
+        return 1;
+    }
+
+    SGDState state(opt.degree);
+    state.seen.maxDegree = opt.degree;
+    choosePolynomialScaling(warmup, state.seen.center, state.seen.scale);
+    state.seen.St.assign(2 * opt.degree + 1, 0.0);
+    state.seen.Sty.assign(opt.degree + 1, 0.0);
+
+    const size_t workers = opt.hogwild ? globalThreadPool().threadCount() : 1;
+    const size_t readSize = opt.batchSize * workers * 4;
+    size_t rows = 0, batches = 0, nextCheckpoint = opt.checkpointEvery;
+    double epochLoss = 0.0, epochW = 0.0;
+    bool diverged = false;
+
+    // Модель с NaN/inf не пишется поверх прошлой хорошей контрольной точки
+    auto checkpoint = [&]()
+    {
+        if (opt.checkpointFile.empty())
+            return;
+        PolyModel model = state.model();
+        if (!polyModelIsFinite(model))
+            std::cerr << "Error: non-finite model after " << rows << " rows, checkpoint not written" << std::endl;
+        else if (saveModelFile(opt.checkpointFile, model, rows))
+            std::cout << "checkpoint: " << rows << " rows -> " << opt.checkpointFile << std::endl;
+        else
+            std::cerr << "Error: failed to write checkpoint " << opt.checkpointFile << std::endl;
+    };
 
-        std::stringstream ss(line);
-        float xVal, yVal;
-        char delimiter;
-        // Попробуем считать x и y
-        if (ss >> xVal)
+    // Пачка считанных точек: разогрев тоже идёт в обучение; статистика
+    // стандартизации обновляется только в первую эпоху
+    auto train = [&](const std::vector<Point>& data, bool observe)
+    {
+        if (observe)
+            observeSGDBatch(state, data);
+        size_t count = (data.size() + opt.batchSize - 1) / opt.batchSize;
+        std::vector<double> losses(count);
+        auto run = [&](size_t b, size_t lo, size_t hi)
         {
-            if (ss.peek() == ',' || ss.peek() == ';')
-                ss >> delimiter;
-            if (ss >> yVal)
-            {
-                data.push_back({xVal, yVal});
-            }
+            losses[b] = sgdStep(state, opt, data.data() + lo, hi - lo);
+        };
+        if (opt.hogwild)
+            parallelForChunks(data.size(), opt.batchSize, run);
+        else
+            for (size_t b = 0; b < count; ++b)
+                run(b, b * opt.batchSize, std::min(data.size(), (b + 1) * opt.batchSize));
+        for (size_t b = 0; b < count; ++b)
+            epochLoss += losses[b];
+        for (auto& p : data)
+            epochW += p.w;
+        rows += data.size();
+        batches += count;
+        diverged = !polyModelIsFinite(state.model());
+        if (opt.checkpointEvery > 0 && batches >= nextCheckpoint)
+        {
+            checkpoint();
+            nextCheckpoint = batches + opt.checkpointEvery;
         }
+    };
+
+    std::vector<Point> chunk;
+    for (int epoch = 0; epoch < std::max(1, opt.epochs) && !diverged; ++epoch)
+    {
+        if (epoch > 0 && !stream.rewind())
+            break; // поток из stdin повторить нельзя
+        epochLoss = epochW = 0.0;
+        if (epoch == 0)
+            train(warmup, true);
+        while (!diverged && stream.nextBatch(chunk, readSize))
+            train(chunk, epoch == 0);
+
+        std::cout << "epoch " << epoch + 1 << ": " << rows << " rows, RMSE (before each step) "
+                  << std::sqrt(epochLoss / std::max(epochW, 1e-300)) << std::endl;
     }
-    file.close();
-    return data;
+
+    PolyModel model = state.model();
+    if (diverged)
+    {
+        std::cerr << "Error: training diverged after " << rows << " rows (non-finite coefficients); "
+                  << "try a smaller --lr" << std::endl;
+        return 1;
+    }
+    checkpoint();
+    std::cout << (opt.adam ? "Adam" : "SGD") << (opt.hogwild ? " Hogwild" : "") << ", degree "
+              << opt.degree << ", " << batches << " mini-batches, "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+              << " s" << std::endl;
+    // Коэффициенты при степенях x для прямой; для степени выше - в переменной t
+    if (opt.degree == 1)
+    {
+        double slope = model.coeffs[1] / model.scale;
+        std::cout << "y = " << slope << "*x + " << model.coeffs[0] - slope * model.center << std::endl;
+    }
+    else
+    {
+        std::cout << "t = (x - " << model.center << ") / " << model.scale << ", y =";
+        for (int k = 0; k <= model.degree; ++k)
+            std::cout << (k ? " + " : " ") << model.coeffs[k] << "*t^" << k;
+        std::cout << std::endl;
+    }
+    return 0;
 }
 
-// Функция сохранения данных в CSV
-void saveDataToCSV(const std::string& filename, const std::vector<Point>& dataPoints)
+// Консольный режим --sgd file.csv [degree] [параметры], см. заголовок файла
+int runSGDCLI(int argc, char* argv[])
 {
-    std::ofstream file(filename);
-    if (!file.is_open())
+    SGDOptions opt;
+    std::string filename = argv[2];
+    for (int i = 3; i < argc; ++i)
     {
-        std::cerr << "Error: Unable to open save file " << filename << std::endl;
-        return;
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--epochs" && hasValue)
+            opt.epochs = std::atoi(argv[++i]);
+        else if (arg == "--batch" && hasValue)
+            opt.batchSize = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--lr" && hasValue)
+            opt.learningRate = std::atof(argv[++i]);
+        else if (arg == "--checkpoint" && hasValue)
+            opt.checkpointFile = argv[++i];
+        else if (arg == "--every" && hasValue)
+            opt.checkpointEvery = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--plain")
+            opt.adam = false;
+        else if (arg == "--hogwild")
+            opt.hogwild = true;
+        else if (i == 3 && std::isdigit(static_cast<unsigned char>(arg[0])))
+            opt.degree = std::atoi(arg.c_str());
+        else
+        {
+            std::cerr << "Error: unknown option " << arg << std::endl;
+            return 1;
+        }
     }
-
-    for (auto& p : dataPoints)
-        file << p.x << "," << p.y << "\n";
-
-    file.close();
-    std::cout << "Data saved to " << filename << std::endl;
+    return runSGDTrainer(filename, opt);
 }
 
 // ----------------------------------------
-// Линейная регрессия (y = slope*x + intercept)
+// Доверительные интервалы и интервалы предсказания
 // ----------------------------------------
-std::pair<float, float> computeLinearRegression(const std::vector<Point>& points)
+
+// Всё, что нужно для интервалов, кешируется при подгонке:
+// (X^T X)^-1 в масштабированной переменной t и остаточная дисперсия.
+struct FitUncertainty
 {
-    if (points.empty())
+    bool valid = false;
+    PolyModel model;
+    std::vector<double> inverseNormal; // (degree+1) x (degree+1)
+    double sigma2 = 0.0;               // RSS / (n - p)
+    double dof = 0.0;                  // n - p
+    double tQuantile = 0.0;            // квантиль Стьюдента для двустороннего уровня
+    std::vector<double> coeffStdErr;   // стандартные ошибки коэффициентов при x^k
+};
+
+// Квантиль стандартного нормального распределения (алгоритм Acklam, ошибка ~1e-9)
+double normalQuantile(double p)
+{
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                               1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                               6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    if (p <= 0.0 || p >= 1.0)
+        return 0.0;
+    if (p < 0.02425)
     {
-        return {0.f, 0.f};
+        double q = std::sqrt(-2.0 * std::log(p));
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+               ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
     }
+    if (p > 1.0 - 0.02425)
+        return -normalQuantile(1.0 - p);
+    double q = p - 0.5;
+    double r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+           (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+}
 
-    float sumX = 0.f, sumY = 0.f;
-    for (auto& p : points)
+// Квантиль распределения Стьюдента: разложение Корниша-Фишера по нормальному
+// квантилю (для dof >= 3 ошибка меньше 1%, чего для полос на графике достаточно)
+double studentTQuantile(double p, double dof)
+{
+    double z = normalQuantile(p);
+    if (dof <= 0.0)
+        return z;
+    double z2 = z * z;
+    double g1 = (z2 + 1.0) * z / 4.0;
+    double g2 = ((5.0 * z2 + 16.0) * z2 + 3.0) * z / 96.0;
+    double g3 = (((3.0 * z2 + 19.0) * z2 + 17.0) * z2 - 15.0) * z / 384.0;
+    double g4 = ((((79.0 * z2 + 776.0) * z2 + 1482.0) * z2 - 1920.0) * z2 - 945.0) * z / 92160.0;
+    return z + g1 / dof + g2 / (dof * dof) + g3 / (dof * dof * dof) + g4 / (dof * dof * dof * dof);
+}
+
+// Кеш для интервалов по моментам самой подгонки - без нового прохода по данным.
+// model - нарисованная модель в базисе моментов (center/scale как у m): RSS и
+// полосы считаются от неё, а (X^T X)^-1 - из тех же моментов.
+// level - двусторонний уровень (0.95).
+FitUncertainty computeFitUncertainty(const PowerMoments& m, const PolyModel& model, double level = 0.95)
+{
+    FitUncertainty u;
+    const int degree = model.degree;
+    const double center = m.center, scale = m.scale;
+    PolyModel solved;
+    const int size = degree + 1;
+    if (model.coeffs.size() != static_cast<size_t>(size) ||
+        !solvePolynomialFromMoments(m, degree, solved, &u.inverseNormal))
+        return u;
+    u.model = model;
+    u.dof = m.St[0] - size;
+    if (u.dof <= 0.0)
+        return u;
+
+    u.sigma2 = residualSumFromMoments(m, u.model) / u.dof;
+    u.tQuantile = studentTQuantile(0.5 + 0.5 * level, u.dof);
+
+    // Ковариация коэффициентов при x^k: c_x = M * c_t
+    std::vector<double> M = powerBasisMatrix(degree, center, scale);
+    u.coeffStdErr.assign(size, 0.0);
+    for (int j = 0; j < size; ++j)
     {
-        sumX += p.x;
-        sumY += p.y;
+        double var = 0.0;
+        for (int a = 0; a < size; ++a)
+            for (int b = 0; b < size; ++b)
+                var += M[j * size + a] * u.inverseNormal[a * size + b] * M[j * size + b];
+        u.coeffStdErr[j] = std::sqrt(std::max(var, 0.0) * u.sigma2);
     }
-    float meanX = sumX / points.size();
-    float meanY = sumY / points.size();
+    u.valid = true;
+    return u;
+}
 
-    float numerator = 0.f;
-    float denominator = 0.f;
-    for (auto& p : points)
+// v = phi^T (X^T X)^-1 phi в точке x, O(degree^2), без прохода по данным
+double normalQuadraticForm(const FitUncertainty& u, float x)
+{
+    const int size = static_cast<int>(u.model.coeffs.size());
+    double t = (x - u.model.center) / u.model.scale;
+    double phi[32];
+    phi[0] = 1.0;
+    for (int k = 1; k < size && k < 32; ++k)
+        phi[k] = phi[k - 1] * t;
+
+    double v = 0.0;
+    for (int a = 0; a < size; ++a)
     {
-        float dx = p.x - meanX;
-        float dy = p.y - meanY;
-        numerator   += dx * dy;
-        denominator += dx * dx;
+        double row = 0.0;
+        for (int b = 0; b < size; ++b)
+            row += u.inverseNormal[a * size + b] * phi[b];
+        v += phi[a] * row;
     }
+    return std::max(v, 0.0);
+}
 
-    float slope = 0.f;
-    if (denominator != 0.f)
-        slope = numerator / denominator;
-    float intercept = meanY - slope * meanX;
-
-    return {slope, intercept};
+// Полуширины доверительного интервала среднего и интервала предсказания в точке x
+void intervalHalfWidths(const FitUncertainty& u, float x, double& confidence, double& prediction)
+{
+    confidence = prediction = 0.0;
+    if (!u.valid)
+        return;
+    double v = normalQuadraticForm(u, x);
+    confidence = u.tQuantile * std::sqrt(u.sigma2 * v);
+    prediction = u.tQuantile * std::sqrt(u.sigma2 * (1.0 + v));
 }
 
 // ----------------------------------------
-// Полиномиальная регрессия 2-й степени: y = a*x^2 + b*x + c
+// Диагностика подгонки
 // ----------------------------------------
-struct Poly2Coeffs
+
+// Класс точки для раскраски: обычная, выброс (большой стандартизованный остаток)
+// или влиятельная (большое расстояние Кука)
+enum class PointClass : std::uint8_t
 {
-    float a; // при x^2
-    float b; // при x
-    float c; // свободный член
+    NORMAL,
+    OUTLIER,
+    INFLUENTIAL
 };
 
-// Решим систему для a,b,c методом составления нормальных уравнений и их решения
-// Формулой Крамера или через матрицу 3x3 (классическая M^-1 * R).
-Poly2Coeffs computePolynomialRegression2(const std::vector<Point>& points)
+// Что показывать рядом с графиком (клавиша D перебирает по кругу)
+enum class DiagnosticsView
 {
-    Poly2Coeffs coeffs{0.f, 0.f, 0.f};
-    if (points.size() < 3)
-    {
-        // Для корректной аппроксимации 2-й степенью нужно хотя бы 3 точки
-        return coeffs;
-    }
+    HIDDEN,
+    STATS,
+    RESIDUALS,   // панель статистики + остатки от x
+    HISTOGRAM    // панель статистики + гистограмма остатков
+};
 
-    // Суммы
-    double Sx   = 0.0;
-    double Sy   = 0.0;
-    double Sx2  = 0.0;
-    double Sx3  = 0.0;
-    double Sx4  = 0.0;
-    double Sxy  = 0.0;
-    double Sx2y = 0.0;
-    int n = static_cast<int>(points.size());
+const int kResidualBins = 24;
+const double kOutlierCutoff = 2.5;
 
-    for (auto& p : points)
-    {
-        double x  = p.x;
-        double y  = p.y;
-        double x2 = x*x;
-        double x3 = x2*x;
-        double x4 = x3*x;
+// Всё, что считается по остаткам после подгонки; остатки кешируются,
+// чтобы отрисовка не пересчитывала модель в каждом кадре
+struct FitDiagnostics
+{
+    bool valid = false;
+    int params = 0;                      // число параметров модели
+    double weightSum = 0.0;
+    double r2 = 0.0;
+    double adjustedR2 = 0.0;
+    double rmse = 0.0;
+    double mae = 0.0;
+    double maxError = 0.0;
+    double robustSigma = 0.0;            // MAD-оценка сигмы остатков
+    std::vector<double> residuals;       // y - model(x)
+    std::vector<double> leverage;        // h_ii, только для МНК-моделей
+    std::vector<double> cooksDistance;   // только для МНК-моделей
+    std::vector<PointClass> pointClass;
+    int outliers = 0;
+    int influential = 0;
+    std::vector<double> histogram;       // взвешенная гистограмма остатков
+    double histMin = 0.0, histMax = 0.0;
+};
 
-        Sx   += x;
-        Sy   += y;
-        Sx2  += x2;
-        Sx3  += x3;
-        Sx4  += x4;
-        Sxy  += x*y;
-        Sx2y += x2*y;
+// Один слитый проход по точкам после подгонки: остатки, суммы для R^2/RMSE/MAE,
+// максимум ошибки, а при известной (X^T X)^-1 - ещё рычаги и расстояние Кука.
+// predict(x) - значение модели; шаблон, чтобы вызов встраивался в цикл.
+// Гистограмма и классы точек считаются вторым дешёвым проходом по кешу остатков.
+template <class Predict>
+FitDiagnostics computeFitDiagnostics(const std::vector<Point>& points, Predict predict, int params,
+                                     const FitUncertainty* uncertainty = nullptr)
+{
+    FitDiagnostics d;
+    const size_t n = points.size();
+    if (n == 0)
+        return d;
+
+    const bool withLeverage = uncertainty && uncertainty->valid;
+    d.params = params;
+    d.residuals.resize(n);
+    if (withLeverage)
+    {
+        d.leverage.resize(n);
+        d.cooksDistance.resize(n);
     }
 
-    // Матрица (3x3) и вектор правой части:
-    // [ n    Sx   Sx2  ] [ c ] = [ Sy   ]
-    // [ Sx   Sx2  Sx3  ] [ b ]   [ Sxy  ]
-    // [ Sx2  Sx3  Sx4  ] [ a ]   [ Sx2y ]
-    //
-    // Ищем (a, b, c).
+    // y сдвигается на первое значение, чтобы SStot не терял точность
+    const double y0 = points[0].y;
+    struct Sums { double w = 0.0, wy = 0.0, wyy = 0.0, wrr = 0.0, war = 0.0, maxAbs = 0.0; };
+    Sums sums = deterministicReduce(n, Sums{}, [&](size_t lo, size_t hi)
+    {
+        Sums b;
+        for (size_t i = lo; i < hi; ++i)
+        {
+            const Point& p = points[i];
+            double r = p.y - static_cast<double>(predict(p.x));
+            if (!std::isfinite(r))
+            {
+                // Точка вне области модели (например, x <= 0 у степенной)
+                d.residuals[i] = 0.0;
+                continue;
+            }
+            double dy = p.y - y0;
+            d.residuals[i] = r;
+            b.w += p.w;
+            b.wy += p.w * dy;
+            b.wyy += p.w * dy * dy;
+            b.wrr += p.w * r * r;
+            b.war += p.w * std::fabs(r);
+            b.maxAbs = std::max(b.maxAbs, std::fabs(r));
 
-    // Составим матрицу A и вектор B
-    double A[3][3] = {
-        { (double)n,  Sx,    Sx2 },
-        { Sx,         Sx2,   Sx3 },
-        { Sx2,        Sx3,   Sx4 }
-    };
-    double B[3] = { Sy, Sxy, Sx2y };
+            if (withLeverage)
+            {
+                // Вес точки - её кратность, поэтому h = w * phi^T C phi
+                double h = p.w * normalQuadraticForm(*uncertainty, p.x);
+                double den = 1.0 - h;
+                d.leverage[i] = h;
+                d.cooksDistance[i] = (den > 1e-12 && uncertainty->sigma2 > 0.0)
+                    ? p.w * r * r / (params * uncertainty->sigma2) * h / (den * den)
+                    : std::numeric_limits<double>::infinity();
+            }
+        }
+        return b;
+    }, [](Sums& acc, const Sums& part)
+    {
+        acc.w += part.w;
+        acc.wy += part.wy;
+        acc.wyy += part.wyy;
+        acc.wrr += part.wrr;
+        acc.war += part.war;
+        acc.maxAbs = std::max(acc.maxAbs, part.maxAbs);
+    });
+    if (sums.w <= 0.0)
+        return d;
 
-    // Чтобы не тащить целую библиотеку линалгебры, можно решить через Крамера вручную:
-    auto det3 = [&](double m[3][3]){
-        return m[0][0]* (m[1][1]*m[2][2] - m[1][2]*m[2][1]) -
-               m[0][1]* (m[1][0]*m[2][2] - m[1][2]*m[2][0]) +
-               m[0][2]* (m[1][0]*m[2][1] - m[1][1]*m[2][0]);
-    };
+    d.weightSum = sums.w;
+    double ssTot = sums.wyy - sums.wy * sums.wy / sums.w;
+    d.r2 = (ssTot > 0.0) ? 1.0 - sums.wrr / ssTot : 0.0;
+    d.adjustedR2 = (sums.w > params) ? 1.0 - (1.0 - d.r2) * (sums.w - 1.0) / (sums.w - params) : d.r2;
+    d.rmse = std::sqrt(sums.wrr / sums.w);
+    d.mae = sums.war / sums.w;
+    d.maxError = sums.maxAbs;
+    d.robustSigma = robustScale(d.residuals, points);
 
-    double D = det3(A);
-    if (std::fabs(D) < 1e-12)
+    // Классы точек и гистограмма по кешированным остаткам
+    d.histMin = -sums.maxAbs;
+    d.histMax = sums.maxAbs;
+    d.histogram.assign(kResidualBins, 0.0);
+    d.pointClass.assign(n, PointClass::NORMAL);
+    double binWidth = (d.histMax - d.histMin) / kResidualBins;
+    double influenceCutoff = 4.0 / sums.w;
+    for (size_t i = 0; i < n; ++i)
     {
-        // Матрица вырождена; иногда такое бывает при плохих данных.
-        // Вернём нули.
-        return coeffs;
-    }
-
-    // D_c (для c)
-    double A_c[3][3];
-    std::memcpy(A_c, A, 9*sizeof(double));
-    A_c[0][0] = B[0];
-    A_c[1][0] = B[1];
-    A_c[2][0] = B[2];
-    double D_c = det3(A_c);
-
-    // D_b (для b)
-    double A_b[3][3];
-    std::memcpy(A_b, A, 9*sizeof(double));
-    A_b[0][1] = B[0];
-    A_b[1][1] = B[1];
-    A_b[2][1] = B[2];
-    double D_b = det3(A_b);
-
-    // D_a (для a)
-    double A_a[3][3];
-    std::memcpy(A_a, A, 9*sizeof(double));
-    A_a[0][2] = B[0];
-    A_a[1][2] = B[1];
-    A_a[2][2] = B[2];
-    double D_a = det3(A_a);
-
-    double c = D_c / D;
-    double b = D_b / D;
-    double a = D_a / D;
-    coeffs.a = static_cast<float>(a);
-    coeffs.b = static_cast<float>(b);
-    coeffs.c = static_cast<float>(c);
+        double r = d.residuals[i];
+        int bin = (binWidth > 0.0) ? static_cast<int>((r - d.histMin) / binWidth) : kResidualBins / 2;
+        d.histogram[std::max(0, std::min(bin, kResidualBins - 1))] += points[i].w;
 
-    return coeffs;
+        double h = withLeverage ? std::min(d.leverage[i], 0.999) : 0.0;
+        double scale = d.robustSigma * std::sqrt(1.0 - h);
+        if (scale > 0.0 && std::fabs(r) > kOutlierCutoff * scale)
+        {
+            d.pointClass[i] = PointClass::OUTLIER;
+            ++d.outliers;
+        }
+        else if (withLeverage && d.cooksDistance[i] > influenceCutoff)
+        {
+            d.pointClass[i] = PointClass::INFLUENTIAL;
+            ++d.influential;
+        }
+    }
+    d.valid = true;
+    return d;
 }
 
-// Вспомогательная функция для вычисления значения полинома 2-й степени
-float evaluatePoly2(const Poly2Coeffs& coeffs, float x)
+int main(int argc, char* argv[])
 {
-    return coeffs.a*x*x + coeffs.b*x + coeffs.c;
-}
+    // Консольные режимы без окна
+    if (argc >= 3 && std::string(argv[1]) == "--multi")
+        return runMultivariateCLI(argv[2], argc >= 4 ? argv[3] : "");
+    if (argc >= 3 && std::string(argv[1]) == "--sgd")
+        return runSGDCLI(argc, argv);
+    if (argc >= 2 && std::string(argv[1]) == "--bench-logistic")
+        return runLogisticBenchmark(argc >= 3 ? std::strtoull(argv[2], nullptr, 10) : 10000000);
+    if (argc >= 2 && std::string(argv[1]) == "--bench-theil-sen")
+        return runTheilSenBenchmark(argc >= 3 ? std::strtoull(argv[2], nullptr, 10) : 1000000);
 
-int main()
-{
     // -----------------------------
     // 1. Загрузка / подготовка данных
     // -----------------------------
@@ -272,6 +5923,34 @@ int main()
         dataPoints.push_back({5.f, 4.5f});
     }
 
+    // Точный режим только по --exact: суммы в int128 однопоточно примерно втрое
+    // медленнее double-ядра, выигрыш - точность и независимость от порядка сложения
+    bool exactRequested = false;
+    for (int i = 1; i < argc; ++i)
+        if (std::string(argv[i]) == "--exact")
+            exactRequested = true;
+
+    // Целочисленные данные читаем ещё раз сразу в int64 - для точного режима
+    IntegerColumns intData;
+    bool intDataValid = exactRequested && loadIntegerDataFromCSV(csvFile, intData);
+    if (intDataValid)
+        std::cout << "Integer data: exact 128-bit accumulation enabled" << std::endl;
+    else if (exactRequested)
+        std::cerr << "--exact: data is not integer or out of range, using the double path" << std::endl;
+
+    // --collapse: сразу схлопнуть повторяющиеся точки во взвешенные
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--collapse")
+        {
+            size_t before = dataPoints.size();
+            dataPoints = collapseDuplicatePoints(dataPoints);
+            std::cout << "Collapsed " << before << " points into " << dataPoints.size() << std::endl;
+            if (intDataValid)
+                intDataValid = integerColumnsFromPoints(dataPoints, intData);
+        }
+    }
+
     // Окно
     sf::RenderWindow window(sf::VideoMode(800, 600), "Regression Linear or Polinom");
     window.setFramerateLimit(60);
@@ -300,14 +5979,23 @@ int main()
     predictionText.setPosition(20.f, 80.f);
 
     // Подсказка (мышь, сохранение, выбор режима регрессии)
-    sf::Text mouseHint("LMB=add point; RMB=remove; S=save; l=Linear; p=Poly2", font, 16);
+    // (мелким шрифтом в несколько строк, чтобы помещалась в окно 800 px)
+    sf::Text mouseHint("LMB=add point; RMB=remove; Shift+drag=fit on x-range; Esc=clear range; S=save\n"
+                       "l=Linear; p=Poly2; e=Exp; z=Power; n=Log; j=GN refine; a=Auto degree; k=Segmented\n"
+                       "h=Huber; t=Tukey; r=RANSAC; g=Ridge; o=Lasso; m=Spline; w=LOESS; q=Deming; [ ]=param\n"
+                       "c=Collapse; b=Bands; d=Diagnostics; v=CV; f=Formula; x=Theil-Sen; u=Quantiles; i=Isotonic; y=Logistic", font, 12);
     mouseHint.setFillColor(sf::Color::White);
-    mouseHint.setPosition(400.f, 20.f);
+    mouseHint.setPosition(300.f, 8.f);
 
     // Текст с текущим типом регрессии
     sf::Text regTypeText("Regression Linear", font, 16);
     regTypeText.setFillColor(sf::Color::Magenta);
-    regTypeText.setPosition(400.f, 50.f);
+    regTypeText.setPosition(300.f, 65.f);
+
+    // Текст с результатами перекрёстной проверки
+    sf::Text cvText("", font, 16);
+    cvText.setFillColor(sf::Color::Cyan);
+    cvText.setPosition(300.f, 90.f);
 
     // Текст для отображения координат около курсора
     sf::Text mouseCoordsText("", font, 14);
@@ -320,9 +6008,111 @@ int main()
     // Параметры полиномиальной регрессии 2-й степени
     Poly2Coeffs polyCoeffs{0.f, 0.f, 0.f};
 
+    // Полином для режимов с PolyModel (автостепень, робастные) и отчёт по всем степеням
+    PolyModel fittedPoly;
+    std::vector<DegreeFitReport> degreeReports;
+
+    // Кусочно-линейная модель, сглаживающий сплайн
+    SegmentedModel segmented;
+    SmoothingSpline spline;
+
+    // LOESS и его доля соседей (меняется клавишами [ ])
+    LoessModel loess;
+    double loessSpan = 0.3;
+
+    // Экспоненциальная, степенная и логарифмическая модели; буферы преобразований
+    // живут между подгонками, уточнение Гаусса-Ньютоном включается клавишей J
+    TransformModel transformModel;
+    TransformWorkspace transformWs;
+    bool refineTransform = true;
+
+    // Квантильные модели (медиана - fittedPoly, остальные рисуются полосой)
+    QuantileFit quantileFit;
+
+    // Монотонная ступенчатая модель
+    IsotonicModel isotonic;
+
+    // Логистическая модель (степень линейного предиктора - от L/P)
+    LogisticModel logistic;
+
+    // Отношение дисперсий ошибок y и x для регрессии Деминга ([ ] - в 2 раза)
+    double demingDelta = 1.0;
+
+    // Формула пользователя (клавиша F): текст, байткод и подогнанные параметры
+    std::string formulaText = "a*sin(b*x)+c";
+    bool formulaEditing = false;
+    bool formulaSkipChar = false; // символ 'f' от нажатия, открывшего редактор
+    CompiledExpr customExpr;
+    CustomFit customFit;
+
     // Какой тип регрессии используем сейчас
     RegressionType currentReg = RegressionType::LINEAR;
 
+    // Степень для робастных режимов: 1 после L, 2 после P
+    int baseDegree = 1;
+
+    // Кеш для интервалов МНК-моделей (линейная, Poly2, автостепень) и их отрисовка
+    FitUncertainty uncertainty;
+    bool showBands = false;
+
+    // Диагностика текущей подгонки (остатки, R^2, рычаги) и панель статистики
+    FitDiagnostics diagnostics;
+    DiagnosticsView diagView = DiagnosticsView::STATS;
+    sf::Text statsText("", font, 14);
+    statsText.setFillColor(sf::Color::White);
+    sf::RectangleShape statsBackground(sf::Vector2f(250.f, 95.f));
+    statsBackground.setFillColor(sf::Color(0, 0, 0, 140));
+
+    // Точки, кривая модели и полосы кешируются и перестраиваются только при изменениях
+    sf::VertexArray pointMesh(sf::Triangles);
+    sf::VertexArray residualMesh(sf::Triangles);
+    sf::VertexArray residualFrame(sf::Lines);
+    sf::Text residualTitle("", font, 14);
+    residualTitle.setFillColor(sf::Color::White);
+    sf::VertexArray curve(sf::Lines);
+    sf::VertexArray predictionBand(sf::TriangleStrip);
+    sf::VertexArray confidenceBand(sf::TriangleStrip);
+    sf::VertexArray quantileBand(sf::TriangleStrip);
+    sf::VertexArray quantileCurves(sf::Lines);
+    bool geometryDirty = true;
+
+    // Локальная подгонка на выбранном Shift+перетаскиванием отрезке по x
+    // (дерево моментов обновляется при каждой правке точек)
+    MomentTree rangeIndex = buildMomentTree(dataPoints);
+    bool rangeDragging = false;
+    bool rangeActive = false;
+    float rangeX0 = 0.f, rangeX1 = 0.f;
+    PolyModel rangeModel;
+    bool rangeModelValid = false;
+    sf::RectangleShape rangeRect;
+    rangeRect.setFillColor(sf::Color(0, 255, 255, 30));
+    sf::VertexArray rangeCurve(sf::LineStrip);
+    sf::Text rangeText("", font, 14);
+    rangeText.setFillColor(sf::Color::Cyan);
+    rangeText.setPosition(20.f, 125.f);
+
+    // Точки по возрастанию x - обход дерева моментов по порядку; общий вход для
+    // моделей на сортировке (LOESS, сплайн, сегменты, изотоническая).
+    // Сбрасывается вместе с каждой правкой дерева.
+    std::vector<Point> sortedPoints;
+    bool sortedPointsValid = false;
+    auto sortedData = [&]() -> const std::vector<Point>&
+    {
+        if (!sortedPointsValid)
+        {
+            sortedPoints.clear();
+            sortedPoints.reserve(dataPoints.size());
+            momentTreeCollect(rangeIndex, rangeIndex.root, -std::numeric_limits<float>::infinity(),
+                              std::numeric_limits<float>::infinity(), sortedPoints);
+            sortedPointsValid = true;
+        }
+        return sortedPoints;
+    };
+
+    // Путь регуляризации (Ridge/Lasso) и выбранная на нём точка
+    RegularizationPath regPath;
+    int lambdaIndex = 50;
+
     // Границы по X и Y
     float minX = 0.f, maxX = 0.f;
     float minY = 0.f, maxY = 0.f;
@@ -333,6 +6123,168 @@ int main()
     sf::Text labelX("X", font, 16);
     sf::Text labelY("Y", font, 16);
 
+    // Выбор точки на пути регуляризации без пересчёта
+    auto applyLambdaIndex = [&]()
+    {
+        if (regPath.models.empty())
+        {
+            fittedPoly = PolyModel{};
+            return;
+        }
+        lambdaIndex = std::max(0, std::min(lambdaIndex, static_cast<int>(regPath.models.size()) - 1));
+        fittedPoly = regPath.models[lambdaIndex];
+        geometryDirty = true;
+
+        std::stringstream ss;
+        ss << (currentReg == RegressionType::RIDGE ? "Regression Ridge" : "Regression Lasso")
+           << " (degree " << kMaxAutoDegree << ", lambda=" << regPath.lambdas[lambdaIndex]
+           << ", nonzero=" << regPath.nonZero[lambdaIndex] << ")";
+        regTypeText.setString(ss.str());
+    };
+
+    // Значение текущей модели в точке x
+    auto predictY = [&](float x) -> float
+    {
+        if (currentReg == RegressionType::LINEAR || currentReg == RegressionType::THEIL_SEN)
+            return slope * x + intercept;
+        if (currentReg == RegressionType::POLYNOMIAL2)
+            return evaluatePoly2(polyCoeffs, x);
+        if (currentReg == RegressionType::SEGMENTED)
+            return evaluateSegmented(segmented, x);
+        if (currentReg == RegressionType::SMOOTHING_SPLINE)
+            return evaluateSmoothingSpline(spline, x);
+        if (currentReg == RegressionType::LOESS)
+            return evaluateLoess(loess, x);
+        if (currentReg == RegressionType::EXPONENTIAL || currentReg == RegressionType::POWER_LAW ||
+            currentReg == RegressionType::LOGARITHMIC)
+            return evaluateTransformModel(transformModel, x);
+        if (currentReg == RegressionType::CUSTOM)
+            return evaluateCompiledExpr(customExpr, customFit.params, x);
+        if (currentReg == RegressionType::ISOTONIC)
+            return evaluateIsotonic(isotonic, x);
+        if (currentReg == RegressionType::LOGISTIC)
+            return evaluateLogistic(logistic, x);
+        return evaluatePolyModel(fittedPoly, x);
+    };
+
+    // Значения модели в пачке точек (отсчёты кривой); сплайн, ступени и формула считаются пакетно
+    auto predictBatch = [&](const std::vector<float>& xs, std::vector<float>& ys)
+    {
+        ys.resize(xs.size());
+        if (currentReg == RegressionType::SMOOTHING_SPLINE)
+        {
+            evaluateSmoothingSplineBatch(spline, xs.data(), ys.data(), xs.size());
+            return;
+        }
+        if (currentReg == RegressionType::ISOTONIC)
+        {
+            evaluateIsotonicBatch(isotonic, xs.data(), ys.data(), xs.size());
+            return;
+        }
+        if (currentReg == RegressionType::CUSTOM && customExpr.valid)
+        {
+            std::vector<Point> at(xs.size());
+            std::vector<double> values(xs.size()), stack;
+            for (size_t i = 0; i < xs.size(); ++i)
+                at[i].x = xs[i];
+            evaluateExprBatch(customExpr, customFit.params.data(), at.data(), at.size(), values.data(), nullptr, stack);
+            for (size_t i = 0; i < xs.size(); ++i)
+                ys[i] = static_cast<float>(values[i]);
+            return;
+        }
+        for (size_t i = 0; i < xs.size(); ++i)
+            ys[i] = predictY(xs[i]);
+    };
+
+    // Диагностика после каждой подгонки: один проход по точкам, дальше всё из кеша
+    auto updateDiagnostics = [&]()
+    {
+        int params = 2;
+        if (currentReg == RegressionType::POLYNOMIAL2)
+            params = 3;
+        else if (currentReg == RegressionType::SEGMENTED)
+            params = 3 * static_cast<int>(segmented.pieces.size()) - 1;
+        else if (currentReg == RegressionType::SMOOTHING_SPLINE)
+            params = std::max(1, static_cast<int>(std::lround(spline.edf)));
+        else if (currentReg == RegressionType::LOESS)
+            params = std::max(2, static_cast<int>(std::lround(2.0 / loessSpan))); // приближённо для степени 1
+        else if (currentReg == RegressionType::EXPONENTIAL || currentReg == RegressionType::POWER_LAW ||
+                 currentReg == RegressionType::LOGARITHMIC)
+            params = 2;
+        else if (currentReg == RegressionType::CUSTOM)
+            params = std::max<int>(1, customFit.params.size());
+        else if (currentReg == RegressionType::ISOTONIC)
+            params = std::max<int>(1, isotonic.value.size());
+        else if (currentReg == RegressionType::LOGISTIC)
+            params = baseDegree + 1;
+        else if (currentReg != RegressionType::LINEAR && currentReg != RegressionType::THEIL_SEN)
+            params = std::max<int>(1, std::count_if(fittedPoly.coeffs.begin(), fittedPoly.coeffs.end(),
+                                                    [](double c) { return c != 0.0; }));
+
+        diagnostics = computeFitDiagnostics(dataPoints, predictY, params,
+                                            uncertainty.valid ? &uncertainty : nullptr);
+        geometryDirty = true;
+        if (!diagnostics.valid)
+        {
+            statsText.setString("");
+            return;
+        }
+
+        std::stringstream ss;
+        ss.precision(4);
+        ss << "R2=" << diagnostics.r2 << "  adj R2=" << diagnostics.adjustedR2 << "\n"
+           << "RMSE=" << diagnostics.rmse << "  MAE=" << diagnostics.mae << "\n"
+           << "max |err|=" << diagnostics.maxError << "\n"
+           << "outliers=" << diagnostics.outliers;
+        if (!diagnostics.leverage.empty())
+            ss << "  influential=" << diagnostics.influential;
+        // Стандартные ошибки коэффициентов при x^0..x^2 (у автостепени - только sigma)
+        if (uncertainty.valid)
+        {
+            ss << "\nsigma=" << std::sqrt(uncertainty.sigma2);
+            if (uncertainty.coeffStdErr.size() <= 3)
+            {
+                ss << "\nse:";
+                for (double se : uncertainty.coeffStdErr)
+                    ss << " " << se;
+            }
+        }
+        statsText.setString(ss.str());
+        // Подложка по высоте текста: строк sigma/se может не быть
+        statsBackground.setSize(sf::Vector2f(250.f, statsText.getLocalBounds().height + 20.f));
+    };
+
+    // Локальная подгонка на отрезке [rangeX0, rangeX1] по дереву моментов
+    auto updateRangeFit = [&]()
+    {
+        rangeModelValid = false;
+        rangeText.setString("");
+        geometryDirty = true;
+        if (!rangeActive && !rangeDragging)
+            return;
+
+        double count = 0.0;
+        int degree = std::min(baseDegree, kRangeMaxDegree);
+        rangeModelValid = fitRangeFromTree(rangeIndex, rangeX0, rangeX1, degree, rangeModel, &count);
+
+        std::stringstream ss;
+        ss.precision(4);
+        ss << "Range [" << std::min(rangeX0, rangeX1) << ", " << std::max(rangeX0, rangeX1) << "]: n=" << count;
+        if (rangeModelValid)
+        {
+            // Коэффициенты при степенях x для подписи - разложением базиса в double,
+            // а не значениями в 0 и +-1 (при x ~ 1e5 это был бы шум float)
+            std::vector<double> c = polyCoeffsInX(rangeModel);
+            if (degree == 1)
+                ss << ", y = " << c[1] << "*x + " << c[0];
+            else
+                ss << ", y = " << c[2] << "*x^2 + " << c[1] << "*x + " << c[0];
+        }
+        else
+            ss << " (not enough points)";
+        rangeText.setString(ss.str());
+    };
+
     // ------------------------------------
     // Лямбда для обновления модели и границ
     // ------------------------------------
@@ -357,42 +6309,355 @@ int main()
             minX -= pad; maxX += pad;
             minY -= pad; maxY += pad;
 
-            // Пересчитываем модель по выбранному типу регрессии
+            // Моменты МНК-подгонки (прямая, парабола, автостепень): из них же
+            // потом считаются интервалы, второго прохода по данным нет
+            PowerMoments lsMoments;
+
+            // Пересчитываем модель по выбранному типу регрессии.
+            // Целочисленные данные идут по точному пути (суммы в int128),
+            // остальные - проходом взвешенных моментов (веса из третьего столбца CSV).
             if (currentReg == RegressionType::LINEAR)
             {
-                auto [s, b] = computeLinearRegression(dataPoints);
+                ExactMoments exact;
+                if (intDataValid)
+                {
+                    exact = accumulateExactMoments(intData);
+                    lsMoments = powerMomentsFromExact(exact, 1);
+                }
+                auto [s, b] = intDataValid ? computeExactLinearRegression(exact)
+                                           : computeWeightedLinearRegression(dataPoints, &lsMoments);
+                slope = s;
+                intercept = b;
+            }
+            else if (currentReg == RegressionType::THEIL_SEN)
+            {
+                auto [s, b] = computeTheilSenRegression(dataPoints);
                 slope = s;
                 intercept = b;
+                std::stringstream ss;
+                ss.precision(4);
+                ss << "Regression Theil-Sen: y = " << slope << "*x + " << intercept;
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::POLYNOMIAL2)
+            {
+                ExactMoments exact;
+                if (intDataValid)
+                {
+                    exact = accumulateExactMoments(intData);
+                    lsMoments = powerMomentsFromExact(exact, 2);
+                }
+                polyCoeffs = intDataValid ? computeExactPolynomialRegression2(exact)
+                                          : computeWeightedPolynomialRegression2(dataPoints, &lsMoments);
+            }
+            else if (currentReg == RegressionType::AUTO_POLYNOMIAL)
+            {
+                degreeReports = fitPolynomialDegrees(dataPoints, kMaxAutoDegree, &lsMoments);
+                int best = selectBestDegree(degreeReports, DegreeCriterion::BIC);
+                fittedPoly = (best >= 0) ? degreeReports[best].model : PolyModel{};
+
+                std::stringstream ss;
+                ss.precision(4);
+                ss << "Regression Auto polynomial (degree " << fittedPoly.degree << ", BIC";
+                if (best >= 0)
+                    ss << "=" << degreeReports[best].bic << ", R2=" << degreeReports[best].r2;
+                ss << ")";
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::ROBUST_HUBER)
+            {
+                fittedPoly = computeRobustRegressionIRLS(dataPoints, baseDegree, RobustLoss::HUBER);
+            }
+            else if (currentReg == RegressionType::ROBUST_TUKEY)
+            {
+                fittedPoly = computeRobustRegressionIRLS(dataPoints, baseDegree, RobustLoss::TUKEY);
+            }
+            else if (currentReg == RegressionType::RANSAC)
+            {
+                fittedPoly = computeRansacRegression(dataPoints, baseDegree);
+            }
+            else if (currentReg == RegressionType::QUANTILE)
+            {
+                quantileFit = computeQuantileRegressions(dataPoints, baseDegree, kBandQuantiles);
+                fittedPoly = quantileFit.models.empty() ? PolyModel{} : quantileFit.models[0];
+                std::stringstream ss;
+                ss << "Regression Quantile (degree " << baseDegree << "): median, p90/p99 band, "
+                   << quantileFit.iterations << " IRLS it.";
+                // Квантили, упёршиеся в лимит итераций: показана лучшая найденная модель
+                bool first = true;
+                for (size_t q = 0; q < quantileFit.converged.size(); ++q)
+                {
+                    if (quantileFit.converged[q])
+                        continue;
+                    ss << (first ? ", not converged: p" : ",p") << std::lround(100.0 * quantileFit.taus[q]);
+                    first = false;
+                }
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::DEMING)
+            {
+                fittedPoly = computeDemingRegression(dataPoints, baseDegree, demingDelta);
+                std::stringstream ss;
+                ss.precision(3);
+                ss << (demingDelta == 1.0 ? "Regression Orthogonal (TLS)" : "Regression Deming")
+                   << " (degree " << baseDegree << ", delta=" << demingDelta << ", [ ] to change)";
+                if (fittedPoly.coeffs.empty())
+                    ss << ": no solution";
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::LOGISTIC)
+            {
+                logistic = computeLogisticRegression(dataPoints, baseDegree);
+                std::stringstream ss;
+                ss.precision(4);
+                ss << "Regression Logistic (degree " << baseDegree << ")";
+                if (!logistic.valid)
+                    ss << ": targets must be 0/1";
+                else
+                    ss << ": logL=" << logistic.logLikelihood << ", " << logistic.iterations << " Newton it"
+                       << (logistic.converged ? "" : ", not converged");
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::ISOTONIC)
+            {
+                isotonic = computeIsotonicRegression(sortedData());
+                regTypeText.setString(std::string("Regression Isotonic (") +
+                                      (isotonic.increasing ? "increasing, " : "decreasing, ") +
+                                      std::to_string(isotonic.value.size()) + " blocks)");
+            }
+            else if (currentReg == RegressionType::SEGMENTED)
+            {
+                segmented = computeSegmentedRegression(sortedData());
+                std::stringstream ss;
+                ss << "Regression Segmented (" << segmented.pieces.size() << " lines, BIC";
+                for (size_t i = 0; i < segmented.breaks.size(); ++i)
+                    ss << (i == 0 ? "; breaks at x=" : ", ") << segmented.breaks[i];
+                ss << ")";
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::SMOOTHING_SPLINE)
+            {
+                spline = computeSmoothingSpline(sortedData());
+                std::stringstream ss;
+                ss.precision(3);
+                ss << "Regression Smoothing spline (edf=" << spline.edf << ", GCV)";
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::LOESS)
+            {
+                loess = computeLoess(sortedData(), loessSpan);
+                std::stringstream ss;
+                ss.precision(2);
+                ss << "Regression LOESS (span=" << loessSpan << ", [ ] to change)";
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::EXPONENTIAL || currentReg == RegressionType::POWER_LAW ||
+                     currentReg == RegressionType::LOGARITHMIC)
+            {
+                transformModel = computeTransformRegression(dataPoints, currentReg, transformWs, refineTransform);
+                std::stringstream ss;
+                ss.precision(4);
+                if (currentReg == RegressionType::EXPONENTIAL)
+                    ss << "Regression y = a*exp(b*x)";
+                else if (currentReg == RegressionType::POWER_LAW)
+                    ss << "Regression y = a*x^b";
+                else
+                    ss << "Regression y = a + b*ln(x)";
+                if (transformModel.valid)
+                    ss << ": a=" << transformModel.a << ", b=" << transformModel.b
+                       << (transformModel.refined ? " (GN)" : refineTransform ? " (GN not applied)" : " (GN off, J)");
+                else
+                    ss << ": not enough valid points";
+                regTypeText.setString(ss.str());
+            }
+            else if (currentReg == RegressionType::CUSTOM)
+            {
+                customFit = fitCustomModel(dataPoints, customExpr);
+                std::stringstream ss;
+                ss.precision(4);
+                ss << "Regression y = " << customExpr.source << ":";
+                for (size_t k = 0; k < customFit.params.size(); ++k)
+                    ss << (k ? ", " : " ") << customExpr.paramNames[k] << "=" << customFit.params[k];
+                ss << " (LM, " << customFit.iterations << " it)";
+                regTypeText.setString(ss.str());
+            }
+            else // RIDGE, LASSO
+            {
+                bool ridge = (currentReg == RegressionType::RIDGE);
+                regPath = computeRegularizationPath(dataPoints, kMaxAutoDegree, ridge);
+                applyLambdaIndex();
             }
-            else // POLYNOMIAL2
+
+            // Интервалы есть только у моделей наименьших квадратов
+            uncertainty = FitUncertainty{};
+            if ((currentReg == RegressionType::LINEAR || currentReg == RegressionType::POLYNOMIAL2 ||
+                 currentReg == RegressionType::AUTO_POLYNOMIAL) && !lsMoments.St.empty())
             {
-                polyCoeffs = computePolynomialRegression2(dataPoints);
+                // Полосы - вокруг той же кривой, что нарисована (predictY)
+                PolyModel drawn =
+                    (currentReg == RegressionType::LINEAR)
+                        ? polyModelFromX({intercept, slope}, lsMoments.center, lsMoments.scale)
+                    : (currentReg == RegressionType::POLYNOMIAL2)
+                        ? polyModelFromX({polyCoeffs.c, polyCoeffs.b, polyCoeffs.a}, lsMoments.center, lsMoments.scale)
+                        : fittedPoly;
+                uncertainty = computeFitUncertainty(lsMoments, drawn);
             }
         }
-        else
+        else
+        {
+            // Если список пуст, ставим что-то по умолчанию
+            minX = -1.f; maxX = 1.f;
+            minY = -1.f; maxY = 1.f;
+            // Линейные коэффициенты
+            slope = 0.f; intercept = 0.f;
+            // Полиномиальные
+            polyCoeffs = {0.f, 0.f, 0.f};
+            fittedPoly = PolyModel{};
+            degreeReports.clear();
+            uncertainty = FitUncertainty{};
+        }
+        updateDiagnostics();
+        updateRangeFit();
+    };
+
+    // Изначальный пересчёт
+    updateModelAndBounds();
+
+    // Перекрёстная проверка текущей модели: 10-fold и leave-one-out
+    auto runCrossValidation = [&]()
+    {
+        CrossValidationResult kfold, loo;
+        bool looSkipped = false;
+        if (currentReg == RegressionType::LINEAR || currentReg == RegressionType::POLYNOMIAL2 ||
+            currentReg == RegressionType::AUTO_POLYNOMIAL)
+        {
+            int degree = 1;
+            if (currentReg == RegressionType::POLYNOMIAL2)
+                degree = 2;
+            else if (currentReg == RegressionType::AUTO_POLYNOMIAL)
+                degree = fittedPoly.degree;
+
+            kfold = crossValidatePolynomial(dataPoints, degree, 10);
+            loo = leaveOneOutPolynomial(dataPoints, degree);
+        }
+        else
+        {
+            // Робастные и регуляризованные модели переподгоняются на каждом фолде
+            RegressionType reg = currentReg;
+            int degree = baseDegree;
+            int pathIndex = lambdaIndex;
+            double span = loessSpan;
+            bool refine = refineTransform;
+            CompiledExpr expr = customExpr;
+            double delta = demingDelta;
+            ModelFitter fit = [reg, degree, pathIndex, span, refine, expr, delta](const std::vector<Point>& train) -> Predictor
+            {
+                if (reg == RegressionType::THEIL_SEN)
+                {
+                    auto [s, b] = computeTheilSenRegression(train);
+                    return [s, b](float x) { return s * x + b; };
+                }
+                if (reg == RegressionType::LOGISTIC)
+                {
+                    LogisticModel lm = computeLogisticRegression(train, degree);
+                    return [lm](float x) { return evaluateLogistic(lm, x); };
+                }
+                if (reg == RegressionType::ISOTONIC)
+                {
+                    IsotonicModel im = computeIsotonicRegression(train);
+                    return [im](float x) { return evaluateIsotonic(im, x); };
+                }
+                if (reg == RegressionType::CUSTOM)
+                {
+                    CustomFit cf = fitCustomModel(train, expr);
+                    return [cf](float x) { return evaluateCompiledExpr(cf.expr, cf.params, x); };
+                }
+                if (reg == RegressionType::SEGMENTED)
+                {
+                    SegmentedModel sm = computeSegmentedRegression(train);
+                    return [sm](float x) { return evaluateSegmented(sm, x); };
+                }
+                if (reg == RegressionType::EXPONENTIAL || reg == RegressionType::POWER_LAW ||
+                    reg == RegressionType::LOGARITHMIC)
+                {
+                    TransformWorkspace ws;
+                    TransformModel tm = computeTransformRegression(train, reg, ws, refine);
+                    return [tm](float x) { return evaluateTransformModel(tm, x); };
+                }
+                if (reg == RegressionType::LOESS)
+                {
+                    LoessModel lm = computeLoess(train, span);
+                    return [lm](float x) { return evaluateLoess(lm, x); };
+                }
+                if (reg == RegressionType::SMOOTHING_SPLINE)
+                {
+                    SmoothingSpline ss = computeSmoothingSpline(train);
+                    return [ss](float x) { return evaluateSmoothingSpline(ss, x); };
+                }
+                PolyModel m;
+                if (reg == RegressionType::ROBUST_HUBER)
+                    m = computeRobustRegressionIRLS(train, degree, RobustLoss::HUBER);
+                else if (reg == RegressionType::ROBUST_TUKEY)
+                    m = computeRobustRegressionIRLS(train, degree, RobustLoss::TUKEY);
+                else if (reg == RegressionType::RANSAC)
+                    m = computeRansacRegression(train, degree);
+                else if (reg == RegressionType::DEMING)
+                    m = computeDemingRegression(train, degree, delta);
+                else if (reg == RegressionType::QUANTILE)
+                {
+                    QuantileFit qf = computeQuantileRegressions(train, degree, {0.5});
+                    if (!qf.models.empty())
+                        m = qf.models[0];
+                }
+                else
+                {
+                    RegularizationPath path = computeRegularizationPath(train, kMaxAutoDegree,
+                                                                        reg == RegressionType::RIDGE);
+                    if (pathIndex < static_cast<int>(path.models.size()))
+                        m = path.models[pathIndex];
+                }
+                return [m](float x) { return evaluatePolyModel(m, x); };
+            };
+            kfold = crossValidateWithRefit(dataPoints, 10, fit);
+            looSkipped = dataPoints.size() > kMaxRefitLOO;
+            if (!looSkipped)
+                loo = crossValidateWithRefit(dataPoints, static_cast<int>(dataPoints.size()), fit);
+        }
+        if (kfold.folds == 0 || (loo.folds == 0 && !looSkipped))
         {
-            // Если список пуст, ставим что-то по умолчанию
-            minX = -1.f; maxX = 1.f;
-            minY = -1.f; maxY = 1.f;
-            // Линейные коэффициенты
-            slope = 0.f; intercept = 0.f;
-            // Полиномиальные
-            polyCoeffs = {0.f, 0.f, 0.f};
+            cvText.setString("CV: not enough points");
+            return;
         }
+
+        std::stringstream cv;
+        cv << "CV RMSE: 10-fold=" << kfold.rmse;
+        if (looSkipped)
+            cv << ", LOO skipped (N > " << kMaxRefitLOO << ", refit model)";
+        else
+            cv << ", LOO=" << loo.rmse;
+        cvText.setString(cv.str());
     };
 
-    // Изначальный пересчёт
-    updateModelAndBounds();
+    // Правая граница основного графика: при открытой панели остатков
+    // он сжимается, освобождая место справа
+    auto residualPanelShown = [&]()
+    {
+        return diagView == DiagnosticsView::RESIDUALS || diagView == DiagnosticsView::HISTOGRAM;
+    };
+    auto plotRight = [&]()
+    {
+        float w = static_cast<float>(window.getSize().x);
+        return residualPanelShown() ? 50.f + 0.62f * (w - 100.f) : w - 50.f;
+    };
 
     // Преобразования координат
     auto toScreenCoords = [&](float x, float y)
     {
-        float w = static_cast<float>(window.getSize().x);
         float h = static_cast<float>(window.getSize().y);
 
         float topMargin = 120.f;
 
-        float screenX = 50.f + (x - minX) / (maxX - minX) * (w - 100.f);
+        float screenX = 50.f + (x - minX) / (maxX - minX) * (plotRight() - 50.f);
         float screenY = h - 50.f - (y - minY) / (maxY - minY) * (h - topMargin - 100.f);
 
         return sf::Vector2f(screenX, screenY);
@@ -400,11 +6665,10 @@ int main()
 
     auto toDataCoords = [&](float sx, float sy)
     {
-        float w = static_cast<float>(window.getSize().x);
         float h = static_cast<float>(window.getSize().y);
         float topMargin = 120.f;
 
-        float x = minX + (sx - 50.f) / (w - 100.f) * (maxX - minX);
+        float x = minX + (sx - 50.f) / (plotRight() - 50.f) * (maxX - minX);
 
         float normY = ((h - 50.f) - sy) / (h - topMargin - 100.f);
         float y = minY + normY * (maxY - minY);
@@ -414,6 +6678,9 @@ int main()
     // Обновление осей
     auto updateAxes = [&]()
     {
+        // Границы или окно изменились - кривую нужно перестроить
+        geometryDirty = true;
+
         // Ось X (из (minX, 0) в (maxX, 0))
         axisX[0].position = toScreenCoords(minX, 0.f);
         axisX[1].position = toScreenCoords(maxX, 0.f);
@@ -437,11 +6704,261 @@ int main()
         labelY.setString("Y");
         labelY.setFillColor(sf::Color::White);
         labelY.setPosition(ly.x + 5.f, ly.y);
+
+        // Панель статистики - в правом верхнем углу основного графика
+        float right = plotRight();
+        statsBackground.setPosition(right - 220.f, 125.f);
+        statsText.setPosition(right - 212.f, 130.f);
     };
 
     // Первый вызов
     updateAxes();
 
+    // Перестроение кешированной геометрии: точки одним массивом треугольников
+    // (цвет по классу из диагностики), кривая модели и полосы 95% интервалов
+    auto rebuildGeometry = [&]()
+    {
+        pointMesh.clear();
+        rangeCurve.clear();
+        residualMesh.clear();
+        residualFrame.clear();
+        residualTitle.setString("");
+        curve.clear();
+        predictionBand.clear();
+        confidenceBand.clear();
+        quantileBand.clear();
+        quantileCurves.clear();
+        if (dataPoints.empty())
+            return;
+
+        // Круг из 8 треугольников; размер растёт с весом точки, но не больше 12 px
+        const int fan = 8;
+        float cosTable[fan + 1], sinTable[fan + 1];
+        for (int k = 0; k <= fan; ++k)
+        {
+            cosTable[k] = std::cos(2.f * 3.14159265f * k / fan);
+            sinTable[k] = std::sin(2.f * 3.14159265f * k / fan);
+        }
+        pointMesh.resize(dataPoints.size() * fan * 3);
+        for (size_t i = 0; i < dataPoints.size(); ++i)
+        {
+            const Point& p = dataPoints[i];
+            sf::Color ptColor = sf::Color::Red;
+            if (diagnostics.valid && i < diagnostics.pointClass.size())
+            {
+                if (diagnostics.pointClass[i] == PointClass::OUTLIER)
+                    ptColor = sf::Color(255, 165, 0);
+                else if (diagnostics.pointClass[i] == PointClass::INFLUENTIAL)
+                    ptColor = sf::Color::Yellow;
+            }
+            float radius = 3.f * std::sqrt(std::min(std::max(p.w, 1.f), 16.f));
+            sf::Vector2f c = toScreenCoords(p.x, p.y);
+            sf::Vertex* tri = &pointMesh[i * fan * 3];
+            for (int k = 0; k < fan; ++k)
+            {
+                tri[3 * k + 0] = sf::Vertex(c, ptColor);
+                tri[3 * k + 1] = sf::Vertex(sf::Vector2f(c.x + radius * cosTable[k], c.y + radius * sinTable[k]), ptColor);
+                tri[3 * k + 2] = sf::Vertex(sf::Vector2f(c.x + radius * cosTable[k + 1], c.y + radius * sinTable[k + 1]), ptColor);
+            }
+        }
+
+        // Выбранный отрезок и локальная подгонка на нём
+        if (rangeActive || rangeDragging)
+        {
+            float lo = std::min(rangeX0, rangeX1), hi = std::max(rangeX0, rangeX1);
+            sf::Vector2f a = toScreenCoords(lo, maxY);
+            sf::Vector2f b = toScreenCoords(hi, minY);
+            rangeRect.setPosition(a.x, a.y);
+            rangeRect.setSize(sf::Vector2f(b.x - a.x, b.y - a.y));
+            if (rangeModelValid)
+            {
+                const int rangeSegments = 100;
+                for (int i = 0; i <= rangeSegments; ++i)
+                {
+                    float xVal = lo + (hi - lo) * i / rangeSegments;
+                    rangeCurve.append(sf::Vertex(toScreenCoords(xVal, evaluatePolyModel(rangeModel, xVal)),
+                                                 sf::Color::Cyan));
+                }
+            }
+        }
+
+        // Панель остатков справа от графика: строится из кешированных остатков
+        float w = static_cast<float>(window.getSize().x);
+        float h = static_cast<float>(window.getSize().y);
+        float left = plotRight() + 40.f, right = w - 30.f;
+        float top = 170.f, bottom = h - 50.f;
+        if (residualPanelShown() && diagnostics.valid && right - left > 40.f && bottom - top > 40.f)
+        {
+
+            // Прямоугольник из двух треугольников
+            auto appendQuad = [&](float x0, float y0, float x1, float y1, sf::Color color)
+            {
+                residualMesh.append(sf::Vertex(sf::Vector2f(x0, y0), color));
+                residualMesh.append(sf::Vertex(sf::Vector2f(x1, y0), color));
+                residualMesh.append(sf::Vertex(sf::Vector2f(x1, y1), color));
+                residualMesh.append(sf::Vertex(sf::Vector2f(x0, y0), color));
+                residualMesh.append(sf::Vertex(sf::Vector2f(x1, y1), color));
+                residualMesh.append(sf::Vertex(sf::Vector2f(x0, y1), color));
+            };
+            auto appendLine = [&](float x0, float y0, float x1, float y1, sf::Color color)
+            {
+                residualFrame.append(sf::Vertex(sf::Vector2f(x0, y0), color));
+                residualFrame.append(sf::Vertex(sf::Vector2f(x1, y1), color));
+            };
+            sf::Color frameColor(160, 160, 160);
+            appendLine(left, top, right, top, frameColor);
+            appendLine(right, top, right, bottom, frameColor);
+            appendLine(right, bottom, left, bottom, frameColor);
+            appendLine(left, bottom, left, top, frameColor);
+            residualTitle.setPosition(left, top - 20.f);
+
+            double range = (diagnostics.maxError > 0.0) ? diagnostics.maxError : 1.0;
+            if (diagView == DiagnosticsView::RESIDUALS)
+            {
+                // Остатки от x: ноль посередине, шкала по максимальной ошибке
+                std::stringstream title;
+                title.precision(3);
+                title << "Residuals vs X (+-" << range << ")";
+                residualTitle.setString(title.str());
+                float midY = 0.5f * (top + bottom);
+                appendLine(left, midY, right, midY, sf::Color::White);
+
+                for (size_t i = 0; i < dataPoints.size(); ++i)
+                {
+                    float sx = left + (dataPoints[i].x - minX) / (maxX - minX) * (right - left);
+                    float sy = midY - static_cast<float>(diagnostics.residuals[i] / range) * 0.5f * (bottom - top - 6.f);
+                    sf::Color color = sf::Color::Red;
+                    if (diagnostics.pointClass[i] == PointClass::OUTLIER)
+                        color = sf::Color(255, 165, 0);
+                    else if (diagnostics.pointClass[i] == PointClass::INFLUENTIAL)
+                        color = sf::Color::Yellow;
+                    appendQuad(sx - 2.f, sy - 2.f, sx + 2.f, sy + 2.f, color);
+                }
+            }
+            else
+            {
+                // Гистограмма остатков: столбцы снизу вверх, ноль - пунктир по центру
+                std::stringstream title;
+                title.precision(3);
+                title << "Residual histogram (+-" << range << ")";
+                residualTitle.setString(title.str());
+                double maxCount = *std::max_element(diagnostics.histogram.begin(), diagnostics.histogram.end());
+                float barWidth = (right - left) / kResidualBins;
+                for (int b = 0; b < kResidualBins; ++b)
+                {
+                    if (maxCount <= 0.0 || diagnostics.histogram[b] <= 0.0)
+                        continue;
+                    float barTop = bottom - static_cast<float>(diagnostics.histogram[b] / maxCount) * (bottom - top - 4.f);
+                    appendQuad(left + b * barWidth + 1.f, barTop, left + (b + 1) * barWidth - 1.f, bottom,
+                               sf::Color(100, 150, 255));
+                }
+                float midX = 0.5f * (left + right);
+                appendLine(midX, top, midX, bottom, sf::Color::White);
+            }
+        }
+
+        // Чтобы "график" полинома (или прямой) был плавным, разобьём на сегменты.
+        // Кривая - набор отрезков, поэтому у кусочной модели она рвётся на границах.
+        int segments = 200;
+        std::vector<float> sampleX(segments + 1), sampleY;
+        for (int i = 0; i <= segments; ++i)
+        {
+            // t идёт от 0 до 1
+            float t = static_cast<float>(i) / static_cast<float>(segments);
+            sampleX[i] = minX + t*(maxX - minX);
+        }
+        predictBatch(sampleX, sampleY);
+
+        float prevX = minX;
+        sf::Vector2f prevPos;
+        for (int i = 0; i <= segments; ++i)
+        {
+            float xVal = sampleX[i];
+            float yVal = sampleY[i];
+            sf::Vector2f pos = toScreenCoords(xVal, yVal);
+            if (i > 0 && currentReg != RegressionType::ISOTONIC)
+            {
+                if (currentReg == RegressionType::SEGMENTED)
+                {
+                    // Каждая граница между соседними отсчётами обрывает линию
+                    for (double b : segmented.breaks)
+                    {
+                        if (b <= prevX || b > xVal)
+                            continue;
+                        int k = segmentIndex(segmented, static_cast<float>(b)) - 1;
+                        float bx = static_cast<float>(b);
+                        curve.append(sf::Vertex(prevPos, sf::Color::Green));
+                        curve.append(sf::Vertex(toScreenCoords(bx, evaluatePolyModel(segmented.pieces[k], bx)),
+                                                sf::Color::Green));
+                        prevPos = toScreenCoords(bx, evaluatePolyModel(segmented.pieces[k + 1], bx));
+                    }
+                }
+                // Вне области модели (NaN) линия обрывается
+                if (std::isfinite(yVal) && std::isfinite(sampleY[i - 1]))
+                {
+                    curve.append(sf::Vertex(prevPos, sf::Color::Green));
+                    curve.append(sf::Vertex(pos, sf::Color::Green));
+                }
+            }
+            prevX = xVal;
+            prevPos = pos;
+
+            if (uncertainty.valid)
+            {
+                double ci, pi;
+                intervalHalfWidths(uncertainty, xVal, ci, pi);
+                sf::Color piColor(0, 200, 0, 40);
+                sf::Color ciColor(0, 255, 0, 80);
+                predictionBand.append(sf::Vertex(toScreenCoords(xVal, yVal + pi), piColor));
+                predictionBand.append(sf::Vertex(toScreenCoords(xVal, yVal - pi), piColor));
+                confidenceBand.append(sf::Vertex(toScreenCoords(xVal, yVal + ci), ciColor));
+                confidenceBand.append(sf::Vertex(toScreenCoords(xVal, yVal - ci), ciColor));
+            }
+        }
+
+        // Изотоническая модель - ступени по блокам: горизонталь на блоке и подъём
+        // к следующему, без отсчётов между ними
+        if (currentReg == RegressionType::ISOTONIC)
+        {
+            for (size_t k = 0; k < isotonic.value.size(); ++k)
+            {
+                float y = static_cast<float>(isotonic.value[k]);
+                float x0 = (k == 0) ? minX : static_cast<float>(isotonic.start[k]);
+                float x1 = (k + 1 == isotonic.value.size()) ? maxX : static_cast<float>(isotonic.start[k + 1]);
+                curve.append(sf::Vertex(toScreenCoords(x0, y), sf::Color::Green));
+                curve.append(sf::Vertex(toScreenCoords(x1, y), sf::Color::Green));
+                if (k + 1 < isotonic.value.size())
+                {
+                    curve.append(sf::Vertex(toScreenCoords(x1, y), sf::Color::Green));
+                    curve.append(sf::Vertex(toScreenCoords(x1, static_cast<float>(isotonic.value[k + 1])),
+                                            sf::Color::Green));
+                }
+            }
+        }
+
+        // Квантильные кривые: полоса от медианы до верхнего квантиля и линии каждого
+        if (currentReg == RegressionType::QUANTILE && quantileFit.models.size() > 1)
+        {
+            const PolyModel& upper = quantileFit.models.back();
+            for (int i = 0; i <= segments; ++i)
+            {
+                quantileBand.append(sf::Vertex(toScreenCoords(sampleX[i], sampleY[i]), sf::Color(255, 140, 0, 50)));
+                quantileBand.append(sf::Vertex(toScreenCoords(sampleX[i], evaluatePolyModel(upper, sampleX[i])),
+                                               sf::Color(255, 140, 0, 50)));
+            }
+            for (size_t q = 1; q < quantileFit.models.size(); ++q)
+            {
+                for (int i = 1; i <= segments; ++i)
+                {
+                    quantileCurves.append(sf::Vertex(toScreenCoords(sampleX[i - 1],
+                        evaluatePolyModel(quantileFit.models[q], sampleX[i - 1])), sf::Color(255, 140, 0)));
+                    quantileCurves.append(sf::Vertex(toScreenCoords(sampleX[i],
+                        evaluatePolyModel(quantileFit.models[q], sampleX[i])), sf::Color(255, 140, 0)));
+                }
+            }
+        }
+    };
+
     // Функция удаления ближайшей точки
     auto removeNearestPoint = [&](float mouseXScreen, float mouseYScreen) {
         if (dataPoints.empty()) return;
@@ -465,7 +6982,17 @@ int main()
         // Порог 10 px
         if (minDist < 10.f && minIndex >= 0)
         {
-            dataPoints.erase(dataPoints.begin() + minIndex);
+            // У схлопнутой точки снимаем одно наблюдение
+            momentTreeErase(rangeIndex, dataPoints[minIndex]);
+            sortedPointsValid = false;
+            if (dataPoints[minIndex].w > 1.f)
+            {
+                dataPoints[minIndex].w -= 1.f;
+                momentTreeInsert(rangeIndex, dataPoints[minIndex]);
+            }
+            else
+                dataPoints.erase(dataPoints.begin() + minIndex);
+            intDataValid = exactRequested && integerColumnsFromPoints(dataPoints, intData);
             updateModelAndBounds();
             updateAxes();
         }
@@ -492,22 +7019,56 @@ int main()
             // Ввод текста (для поля userInputX)
             if (event.type == sf::Event::TextEntered)
             {
+                // Редактор формулы перехватывает весь ввод
+                if (formulaEditing)
+                {
+                    sf::Uint32 c = event.text.unicode;
+                    if (formulaSkipChar && (c == 'f' || c == 'F'))
+                    {
+                        formulaSkipChar = false;
+                    }
+                    else if (c == '\r' || c == '\n')
+                    {
+                        CompiledExpr compiled = compileExpression(formulaText);
+                        if (compiled.valid)
+                        {
+                            customExpr = compiled;
+                            formulaEditing = false;
+                            currentReg = RegressionType::CUSTOM;
+                            updateModelAndBounds();
+                            updateAxes();
+                        }
+                        else
+                        {
+                            regTypeText.setString("Formula error: " + compiled.error);
+                        }
+                    }
+                    else if (c == 8 && !formulaText.empty())
+                    {
+                        formulaText.pop_back();
+                    }
+                    else if (c >= 32 && c < 127)
+                    {
+                        formulaText += static_cast<char>(c);
+                    }
+                }
                 // Enter
-                if (event.text.unicode == '\r' || event.text.unicode == '\n')
+                else if (event.text.unicode == '\r' || event.text.unicode == '\n')
                 {
                     // Преобразуем введённый X в число и считаем предсказание
                     try {
                         float xVal = std::stof(userInputX);
-                        float yPred = 0.f;
-                        if (currentReg == RegressionType::LINEAR)
-                        {
-                            yPred = slope * xVal + intercept;
-                        }
-                        else
+                        float yPred = predictY(xVal);
+                        std::string text = "Prediction: Y = " + std::to_string(yPred);
+                        if (uncertainty.valid)
                         {
-                            yPred = evaluatePoly2(polyCoeffs, xVal);
+                            double ci, pi;
+                            intervalHalfWidths(uncertainty, xVal, ci, pi);
+                            std::stringstream band;
+                            band << "\n95% PI: " << yPred - pi << " .. " << yPred + pi;
+                            text += band.str();
                         }
-                        predictionText.setString("Prediction: Y = " + std::to_string(yPred));
+                        predictionText.setString(text);
                     }
                     catch (...)
                     {
@@ -531,8 +7092,14 @@ int main()
                 }
             }
 
+            // Пока редактируется формула, клавиши-команды не действуют; Esc - отмена
+            if (event.type == sf::Event::KeyPressed && formulaEditing)
+            {
+                if (event.key.code == sf::Keyboard::Escape)
+                    formulaEditing = false;
+            }
             // Нажатия клавиш
-            if (event.type == sf::Event::KeyPressed)
+            else if (event.type == sf::Event::KeyPressed)
             {
                 // Сохранение CSV
                 if (event.key.code == sf::Keyboard::S)
@@ -543,6 +7110,7 @@ int main()
                 if (event.key.code == sf::Keyboard::L)
                 {
                     currentReg = RegressionType::LINEAR;
+                    baseDegree = 1;
                     regTypeText.setString("Current Regression: Linear");
                     updateModelAndBounds();
                     updateAxes();
@@ -551,10 +7119,194 @@ int main()
                 if (event.key.code == sf::Keyboard::P)
                 {
                     currentReg = RegressionType::POLYNOMIAL2;
+                    baseDegree = 2;
                     regTypeText.setString("Regression Polynomial (2nd degree)");
                     updateModelAndBounds();
                     updateAxes();
                 }
+                // Автоматический выбор степени (1..kMaxAutoDegree) по BIC
+                if (event.key.code == sf::Keyboard::A)
+                {
+                    currentReg = RegressionType::AUTO_POLYNOMIAL;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Робастные режимы (степень - от последнего выбора L/P)
+                if (event.key.code == sf::Keyboard::H)
+                {
+                    currentReg = RegressionType::ROBUST_HUBER;
+                    regTypeText.setString("Regression Huber IRLS (degree " + std::to_string(baseDegree) + ")");
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                if (event.key.code == sf::Keyboard::T)
+                {
+                    currentReg = RegressionType::ROBUST_TUKEY;
+                    regTypeText.setString("Regression Tukey IRLS (degree " + std::to_string(baseDegree) + ")");
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                if (event.key.code == sf::Keyboard::R)
+                {
+                    currentReg = RegressionType::RANSAC;
+                    regTypeText.setString("Regression RANSAC (degree " + std::to_string(baseDegree) + ")");
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Кусочно-линейная регрессия
+                if (event.key.code == sf::Keyboard::K)
+                {
+                    currentReg = RegressionType::SEGMENTED;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Модели через преобразования: экспонента, степень, логарифм
+                if (event.key.code == sf::Keyboard::E || event.key.code == sf::Keyboard::Z ||
+                    event.key.code == sf::Keyboard::N)
+                {
+                    currentReg = (event.key.code == sf::Keyboard::E) ? RegressionType::EXPONENTIAL
+                               : (event.key.code == sf::Keyboard::Z) ? RegressionType::POWER_LAW
+                                                                     : RegressionType::LOGARITHMIC;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Уточнение Гаусса-Ньютоном в исходных координатах
+                if (event.key.code == sf::Keyboard::J)
+                {
+                    refineTransform = !refineTransform;
+                    if (currentReg == RegressionType::EXPONENTIAL || currentReg == RegressionType::POWER_LAW ||
+                        currentReg == RegressionType::LOGARITHMIC)
+                    {
+                        updateModelAndBounds();
+                        updateAxes();
+                    }
+                }
+                // LOESS
+                if (event.key.code == sf::Keyboard::W)
+                {
+                    currentReg = RegressionType::LOESS;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Сглаживающий сплайн
+                if (event.key.code == sf::Keyboard::M)
+                {
+                    currentReg = RegressionType::SMOOTHING_SPLINE;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Регуляризованный полином: весь путь lambda считается сразу
+                if (event.key.code == sf::Keyboard::G || event.key.code == sf::Keyboard::O)
+                {
+                    currentReg = (event.key.code == sf::Keyboard::G) ? RegressionType::RIDGE
+                                                                     : RegressionType::LASSO;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Сдвиг по пути регуляризации: [ - сильнее, ] - слабее
+                if ((event.key.code == sf::Keyboard::LBracket || event.key.code == sf::Keyboard::RBracket) &&
+                    (currentReg == RegressionType::RIDGE || currentReg == RegressionType::LASSO))
+                {
+                    lambdaIndex += (event.key.code == sf::Keyboard::LBracket) ? -5 : 5;
+                    applyLambdaIndex();
+                    updateDiagnostics();
+                }
+                // Доля соседей LOESS
+                if ((event.key.code == sf::Keyboard::LBracket || event.key.code == sf::Keyboard::RBracket) &&
+                    currentReg == RegressionType::LOESS)
+                {
+                    loessSpan += (event.key.code == sf::Keyboard::LBracket) ? -0.05 : 0.05;
+                    loessSpan = std::max(0.05, std::min(loessSpan, 1.0));
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Отношение дисперсий ошибок для Деминга
+                if ((event.key.code == sf::Keyboard::LBracket || event.key.code == sf::Keyboard::RBracket) &&
+                    currentReg == RegressionType::DEMING)
+                {
+                    demingDelta *= (event.key.code == sf::Keyboard::LBracket) ? 0.5 : 2.0;
+                    demingDelta = std::max(1.0 / 1024.0, std::min(demingDelta, 1024.0));
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Схлопнуть повторяющиеся точки во взвешенные
+                if (event.key.code == sf::Keyboard::C)
+                {
+                    size_t before = dataPoints.size();
+                    dataPoints = collapseDuplicatePoints(dataPoints);
+                    intDataValid = exactRequested && integerColumnsFromPoints(dataPoints, intData);
+                    rangeIndex = buildMomentTree(dataPoints);
+                    sortedPointsValid = false;
+                    updateModelAndBounds();
+                    updateAxes();
+                    // Прежний результат CV относился к другим данным - на его месте итог схлопывания
+                    cvText.setString("Collapsed " + std::to_string(before) + " points into " +
+                                     std::to_string(dataPoints.size()) + " (V - rerun CV)");
+                }
+                // Сброс выделенного отрезка
+                if (event.key.code == sf::Keyboard::Escape)
+                {
+                    rangeActive = false;
+                    rangeDragging = false;
+                    updateRangeFit();
+                }
+                // Полосы доверительного интервала и интервала предсказания
+                if (event.key.code == sf::Keyboard::B)
+                {
+                    showBands = !showBands;
+                }
+                // Диагностика: статистика -> остатки от x -> гистограмма -> скрыто
+                if (event.key.code == sf::Keyboard::D)
+                {
+                    diagView = static_cast<DiagnosticsView>((static_cast<int>(diagView) + 1) % 4);
+                    updateAxes();
+                }
+                // Перекрёстная проверка
+                if (event.key.code == sf::Keyboard::V)
+                {
+                    runCrossValidation();
+                }
+                // Логистическая регрессия для целевых 0/1 (степень - от L/P)
+                if (event.key.code == sf::Keyboard::Y)
+                {
+                    currentReg = RegressionType::LOGISTIC;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Изотоническая (монотонная) регрессия
+                if (event.key.code == sf::Keyboard::I)
+                {
+                    currentReg = RegressionType::ISOTONIC;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Квантильная регрессия: медиана и полоса p90/p99 (степень - от L/P)
+                if (event.key.code == sf::Keyboard::U)
+                {
+                    currentReg = RegressionType::QUANTILE;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Деминг / ортогональная регрессия (степень - от последнего выбора L/P)
+                if (event.key.code == sf::Keyboard::Q)
+                {
+                    currentReg = RegressionType::DEMING;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Оценка Тейла-Сена
+                if (event.key.code == sf::Keyboard::X)
+                {
+                    currentReg = RegressionType::THEIL_SEN;
+                    updateModelAndBounds();
+                    updateAxes();
+                }
+                // Ввод формулы для нелинейной подгонки
+                if (event.key.code == sf::Keyboard::F)
+                {
+                    formulaEditing = true;
+                    formulaSkipChar = true;
+                }
             }
 
             // Мышь
@@ -563,24 +7315,65 @@ int main()
                 float sx = static_cast<float>(event.mouseButton.x);
                 float sy = static_cast<float>(event.mouseButton.y);
 
-                if (event.mouseButton.button == sf::Mouse::Left)
+                // Клики по панели остатков не добавляют и не удаляют точки
+                bool inResidualPanel = residualPanelShown() && sx > plotRight();
+
+                bool shiftHeld = sf::Keyboard::isKeyPressed(sf::Keyboard::LShift) ||
+                                 sf::Keyboard::isKeyPressed(sf::Keyboard::RShift);
+
+                if (!inResidualPanel && shiftHeld && event.mouseButton.button == sf::Mouse::Left)
+                {
+                    // Shift+перетаскивание выделяет отрезок по x
+                    rangeDragging = true;
+                    rangeActive = false;
+                    rangeX0 = rangeX1 = toDataCoords(sx, sy).x;
+                    updateRangeFit();
+                }
+                else if (!inResidualPanel && event.mouseButton.button == sf::Mouse::Left)
                 {
                     // Добавить точку
                     sf::Vector2f dataPos = toDataCoords(sx, sy);
                     dataPoints.push_back({dataPos.x, dataPos.y});
+                    momentTreeInsert(rangeIndex, dataPoints.back());
+                    sortedPointsValid = false;
+                    intDataValid = exactRequested && integerColumnsFromPoints(dataPoints, intData);
                     updateModelAndBounds();
                     updateAxes();
                 }
-                else if (event.mouseButton.button == sf::Mouse::Right)
+                else if (!inResidualPanel && event.mouseButton.button == sf::Mouse::Right)
                 {
                     // Удалить точку
                     removeNearestPoint(sx, sy);
                 }
             }
+
+            // Перетаскивание границы отрезка: подгонка пересчитывается сразу
+            if (event.type == sf::Event::MouseMoved && rangeDragging)
+            {
+                rangeX1 = toDataCoords(static_cast<float>(event.mouseMove.x),
+                                       static_cast<float>(event.mouseMove.y)).x;
+                updateRangeFit();
+            }
+            if (event.type == sf::Event::MouseButtonReleased && rangeDragging &&
+                event.mouseButton.button == sf::Mouse::Left)
+            {
+                rangeDragging = false;
+                rangeActive = (rangeX0 != rangeX1);
+                updateRangeFit();
+            }
         }
 
-        // Обновляем текст ввода
-        inputText.setString(userInputX);
+        // Обновляем текст ввода: число X или редактируемая формула
+        if (formulaEditing)
+        {
+            inputPrompt.setString("Formula (Enter to fit, Esc to cancel):");
+            inputText.setString("y = " + formulaText + "_");
+        }
+        else
+        {
+            inputPrompt.setString("Enter X value (Press Enter):");
+            inputText.setString(userInputX);
+        }
 
         // Обновляем мышиные координаты (коорд. данных), выводим рядом с курсором
         sf::Vector2i mousePos = sf::Mouse::getPosition(window);
@@ -603,6 +7396,7 @@ int main()
         window.draw(predictionText);
         window.draw(mouseHint);
         window.draw(regTypeText);
+        window.draw(cvText);
 
         // Оси
         window.draw(axisX);
@@ -610,57 +7404,38 @@ int main()
         window.draw(labelX);
         window.draw(labelY);
 
-        // Точки
-        float highlightThreshold = 0.5f;
-        for (auto& p : dataPoints)
+        // Точки и регрессионная функция (кеш перестраивается только после изменений).
+        // Красные - обычные точки, оранжевые - выбросы, жёлтые - влиятельные.
+        if (geometryDirty)
         {
-            // Считаем "предсказанную" Y по текущей модели
-            float yPred = 0.f;
-            if (currentReg == RegressionType::LINEAR)
-            {
-                yPred = slope*p.x + intercept;
-            }
-            else
-            {
-                yPred = evaluatePoly2(polyCoeffs, p.x);
-            }
-
-            float diff = std::fabs(p.y - yPred);
-            sf::Color ptColor = (diff > highlightThreshold) ? sf::Color::Red : sf::Color::Red;
-
-            sf::Vector2f ptPos = toScreenCoords(p.x, p.y);
-            sf::CircleShape shape(3.f);
-            shape.setFillColor(ptColor);
-            shape.setPosition(ptPos.x - 3.f, ptPos.y - 3.f);
-            window.draw(shape);
+            rebuildGeometry();
+            geometryDirty = false;
         }
-
-        // Рисуем регрессионную функцию
-        if (!dataPoints.empty())
+        if (rangeActive || rangeDragging)
+            window.draw(rangeRect);
+        window.draw(pointMesh);
+        if (showBands)
         {
-            // Чтобы "график" полинома (или прямой) был плавным, разобьём на сегменты
-            sf::VertexArray curve(sf::LineStrip);
-            int segments = 200;
-            for (int i = 0; i <= segments; ++i)
-            {
-                // t идёт от 0 до 1
-                float t = static_cast<float>(i) / static_cast<float>(segments);
-                float xVal = minX + t*(maxX - minX);
-
-                float yVal = 0.f;
-                if (currentReg == RegressionType::LINEAR)
-                {
-                    yVal = slope * xVal + intercept;
-                }
-                else
-                {
-                    yVal = evaluatePoly2(polyCoeffs, xVal);
-                }
+            window.draw(predictionBand);
+            window.draw(confidenceBand);
+        }
+        window.draw(quantileBand);
+        window.draw(quantileCurves);
+        window.draw(curve);
+        window.draw(rangeCurve);
+        window.draw(rangeText);
 
-                sf::Vector2f sc = toScreenCoords(xVal, yVal);
-                curve.append(sf::Vertex(sc, sf::Color::Green));
-            }
-            window.draw(curve);
+        // Панель статистики подгонки и панель остатков
+        if (diagView != DiagnosticsView::HIDDEN && diagnostics.valid)
+        {
+            window.draw(statsBackground);
+            window.draw(statsText);
+        }
+        if (residualPanelShown())
+        {
+            window.draw(residualFrame);
+            window.draw(residualMesh);
+            window.draw(residualTitle);
         }
 
         // Рисуем текст координат у курсора